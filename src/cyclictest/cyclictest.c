@@ -25,7 +25,9 @@
 #include <time.h>
 #include <errno.h>
 #include <limits.h>
+#include <poll.h>
 
+#include <sys/eventfd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
@@ -38,12 +40,15 @@
 #include "rt-utils.h"
 #include "rt-numa.h"
 #include "rt-error.h"
+#include "rt-cgroup.h"
+#include "rt-irq.h"
 #include "histogram.h"
 
 #include <bionic.h>
 
 #define DEFAULT_INTERVAL 1000
 #define DEFAULT_DISTANCE 500
+#define DEFAULT_REFRESH 10000
 
 #ifndef SCHED_IDLE
 #define SCHED_IDLE 5
@@ -100,6 +105,9 @@ extern int clock_nanosleep(clockid_t __clock_id, int __flags,
 /* Must be power of 2 ! */
 #define VALBUF_SIZE		16384
 
+/* Room for one formatted status line, see snprint_stat() */
+#define STATUS_LINE_SIZE	160
+
 #if (defined(__i386__) || defined(__x86_64__))
 #define ARCH_HAS_SMI_COUNTER
 #endif
@@ -181,6 +189,8 @@ static int histofall = 0;
 static int duration = 0;
 static int use_nsecs = 0;
 static int refresh_on_max;
+static int refresh = DEFAULT_REFRESH;
+static int silent;
 static int force_sched_other;
 static int priospread = 0;
 static int check_clock_resolution;
@@ -190,6 +200,8 @@ static pthread_t fifo_threadid;
 static int laptop = 0;
 static int power_management = 0;
 static int use_histfile = 0;
+static int isolate;
+static int steer_irqs;
 
 #ifdef ARCH_HAS_SMI_COUNTER
 static int smi = 0;
@@ -197,8 +209,8 @@ static int smi = 0;
 #define smi	0
 #endif
 
-static pthread_cond_t refresh_on_max_cond = PTHREAD_COND_INITIALIZER;
-static pthread_mutex_t refresh_on_max_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Wakes the main thread when the status output has to be updated */
+static int status_efd = -1;
 
 static pthread_mutex_t break_thread_id_lock = PTHREAD_MUTEX_INITIALIZER;
 static pid_t break_thread_id = 0;
@@ -219,6 +231,7 @@ static struct thread_param **parameters;
 static struct thread_stat **statistics;
 static struct histoset hset;
 
+static int snprint_stat(char *buf, size_t size, struct thread_param *par, int index);
 static void print_stat(FILE *fp, struct thread_param *par, int index, int verbose, int quiet);
 static void rstat_print_stat(struct thread_param *par, int index, int verbose, int quiet);
 static void rstat_setup(void);
@@ -617,6 +630,40 @@ static int has_smi_counter(void)
 }
 #endif
 
+/*
+ * Kick the main thread. Only uses write(2), so it is safe to call
+ * from the measurement threads as well as from signal handlers.
+ */
+static void status_wakeup(void)
+{
+	uint64_t one = 1;
+
+	if (status_efd >= 0)
+		write(status_efd, &one, sizeof(one));
+}
+
+/*
+ * Sleep until someone calls status_wakeup() or timeout_us expires.
+ * A negative timeout sleeps until woken up.
+ */
+static void status_wait(int timeout_us)
+{
+	struct pollfd pfd = { .fd = status_efd, .events = POLLIN };
+	uint64_t cnt;
+	int timeout_ms = -1;
+
+	if (timeout_us >= 0)
+		timeout_ms = (timeout_us + 999) / 1000;
+
+	if (status_efd < 0) {
+		usleep(timeout_us >= 0 ? timeout_us : DEFAULT_REFRESH);
+		return;
+	}
+
+	if (poll(&pfd, 1, timeout_ms) > 0)
+		read(status_efd, &cnt, sizeof(cnt));
+}
+
 /*
  * timer thread
  *
@@ -645,6 +692,10 @@ static void *timerthread(void *param)
 	pthread_t thread;
 	unsigned long smi_now, smi_old = 0;
 
+	/* the main thread stays on the housekeeping CPUs */
+	if (isolate && cgroup_isolate_thread(0))
+		fatal("Could not move thread into the isolated partition\n");
+
 	/* if we're running in numa mode, set our memory node */
 	if (par->node != -1)
 		rt_numa_set_numa_run_on_node(par->node, par->cpu);
@@ -834,7 +885,7 @@ static void *timerthread(void *param)
 		if (diff > stat->max) {
 			stat->max = diff;
 			if (refresh_on_max)
-				pthread_cond_signal(&refresh_on_max_cond);
+				status_wakeup();
 		}
 		stat->avg += (double) diff;
 
@@ -890,16 +941,14 @@ static void *timerthread(void *param)
 	}
 
 out:
-	if (refresh_on_max) {
-		pthread_mutex_lock(&refresh_on_max_lock);
-		/* We could reach here with both shutdown and allstopped unset (0).
-		 * Set shutdown with synchronization to notify the main
-		 * thread not to be blocked when it should exit.
-		 */
+	/* We could reach here with both shutdown and allstopped unset (0).
+	 * With refresh_on_max the main thread only wakes up on events, so
+	 * set shutdown to make sure it does not stay blocked when it should
+	 * exit.
+	 */
+	if (refresh_on_max)
 		shutdown++;
-		pthread_cond_signal(&refresh_on_max_cond);
-		pthread_mutex_unlock(&refresh_on_max_lock);
-	}
+	status_wakeup();
 
 	if (par->mode == MODE_CYCLIC)
 		timer_delete(timer);
@@ -961,6 +1010,8 @@ static void display_help(int error)
 	       "-H       --histofall=US    same as -h except with an additional summary column\n"
 	       "	 --histfile=<path> dump the latency histogram to <path> instead of stdout\n"
 	       "-i INTV  --interval=INTV   base interval of thread in us default=1000\n"
+	       "         --isolate         run on a cgroup v2 isolated partition made of\n"
+	       "                           the CPUs given with -a CPUSET\n"
 	       "         --json=FILENAME   write final results into FILENAME, JSON formatted\n"
 	       "	 --laptop	   Save battery when running cyclictest\n"
 	       "			   This will give you poorer realtime results\n"
@@ -975,6 +1026,9 @@ static void display_help(int error)
 	       "-m       --mlockall        lock current and future memory allocations\n"
 	       "-M       --refresh_on_max  delay updating the screen until a new max\n"
 	       "			   latency is hit. Useful for low bandwidth.\n"
+	       "         --status-interval=USEC\n"
+	       "                           update the status output at most every USEC,\n"
+	       "                           also with -M, default=10000\n"
 	       "-N       --nsecs           print results in ns instead of us (default us)\n"
 	       "-o RED   --oscope=RED      oscilloscope mode, reduce verbose output by RED\n"
 	       "-p PRIO  --priority=PRIO   priority of highest prio thread\n"
@@ -988,6 +1042,8 @@ static void display_help(int error)
 	       "                           reported with -X\n"
 	       "         --secaligned [USEC] align thread wakeups to the next full second\n"
 	       "                           and apply the optional offset\n"
+	       "         --silent          like -q, but don't print the summary on exit\n"
+	       "                           either. Useful together with --json\n"
 	       "-s       --system          use sys_nanosleep and sys_setitimer\n"
 	       "-S       --smp             Standard SMP testing: options -a -t and same priority\n"
 	       "                           of all threads\n"
@@ -995,6 +1051,8 @@ static void display_help(int error)
 	       "	--spike-nodes=[num of nodes]\n"
 	       "			   These are the maximum number of spikes we can record.\n"
 	       "			   The default is 1024 if not specified\n"
+	       "         --steer-irqs      move all IRQs off the CPUs given with -a CPUSET\n"
+	       "                           and restore their affinity on exit\n"
 #ifdef ARCH_HAS_SMI_COUNTER
                "         --smi             Enable SMI counting\n"
 #endif
@@ -1088,6 +1146,7 @@ enum option_values {
 	OPT_DBGCYCLIC, OPT_POLICY, OPT_HELP, OPT_NUMOPTS,
 	OPT_ALIGNED, OPT_SECALIGNED, OPT_LAPTOP, OPT_SMI,
 	OPT_TRACEMARK, OPT_POSIX_TIMERS, OPT_DEEPEST_IDLE_STATE,
+	OPT_STATUS_INTERVAL, OPT_SILENT, OPT_ISOLATE, OPT_STEER_IRQS,
 };
 
 /* Process commandline options */
@@ -1116,12 +1175,14 @@ static void process_options(int argc, char *argv[], int max_cpus)
 			{"histofall",        required_argument, NULL, OPT_HISTOFALL },
 			{"histfile",	     required_argument, NULL, OPT_HISTFILE },
 			{"interval",         required_argument, NULL, OPT_INTERVAL },
+			{"isolate",          no_argument,       NULL, OPT_ISOLATE },
 			{"json",             required_argument, NULL, OPT_JSON },
 			{"laptop",	     no_argument,	NULL, OPT_LAPTOP },
 			{"loops",            required_argument, NULL, OPT_LOOPS },
 			{"mainaffinity",     required_argument, NULL, OPT_MAINAFFINITY},
 			{"mlockall",         no_argument,       NULL, OPT_MLOCKALL },
 			{"refresh_on_max",   no_argument,       NULL, OPT_REFRESH },
+			{"status-interval",  required_argument, NULL, OPT_STATUS_INTERVAL },
 			{"nsecs",            no_argument,       NULL, OPT_NSECS },
 			{"oscope",           required_argument, NULL, OPT_OSCOPE },
 			{"priority",         required_argument, NULL, OPT_PRIORITY },
@@ -1130,11 +1191,13 @@ static void process_options(int argc, char *argv[], int max_cpus)
 			{"relative",         no_argument,       NULL, OPT_RELATIVE },
 			{"resolution",       no_argument,       NULL, OPT_RESOLUTION },
 			{"secaligned",       optional_argument, NULL, OPT_SECALIGNED },
+			{"silent",           no_argument,       NULL, OPT_SILENT },
 			{"system",           no_argument,       NULL, OPT_SYSTEM },
 			{"smi",              no_argument,       NULL, OPT_SMI },
 			{"smp",              no_argument,       NULL, OPT_SMP },
 			{"spike",	     required_argument, NULL, OPT_TRIGGER },
 			{"spike-nodes",	     required_argument, NULL, OPT_TRIGGER_NODES },
+			{"steer-irqs",       no_argument,       NULL, OPT_STEER_IRQS },
 			{"threads",          optional_argument, NULL, OPT_THREADS },
 			{"tracemark",	     no_argument,	NULL, OPT_TRACEMARK },
 			{"unbuffered",       no_argument,       NULL, OPT_UNBUFFERED },
@@ -1224,6 +1287,10 @@ static void process_options(int argc, char *argv[], int max_cpus)
 		case 'i':
 		case OPT_INTERVAL:
 			interval = atoi(optarg); break;
+		case OPT_ISOLATE:
+			isolate = 1; break;
+		case OPT_STEER_IRQS:
+			steer_irqs = 1; break;
 		case OPT_JSON:
 			strncpy(jsonfile, optarg, strnlen(optarg, MAX_PATH-1));
 			break;
@@ -1246,6 +1313,8 @@ static void process_options(int argc, char *argv[], int max_cpus)
 		case 'M':
 		case OPT_REFRESH:
 			refresh_on_max = 1; break;
+		case OPT_STATUS_INTERVAL:
+			refresh = atoi(optarg); break;
 		case 'N':
 		case OPT_NSECS:
 			use_nsecs = 1; break;
@@ -1276,6 +1345,10 @@ static void process_options(int argc, char *argv[], int max_cpus)
 			else
 				offset = 0;
 			break;
+		case OPT_SILENT:
+			silent = 1;
+			quiet = 1;
+			break;
 		case 's':
 		case OPT_SYSTEM:
 			use_system = MODE_SYS_OFFSET; break;
@@ -1390,6 +1463,14 @@ static void process_options(int argc, char *argv[], int max_cpus)
 	if (histogram < 0)
 		error = 1;
 
+	if (refresh <= 0)
+		error = 1;
+
+	if (silent && verbose) {
+		warn("--silent and -v are mutually exclusive\n");
+		error = 1;
+	}
+
 	if (histogram > HIST_MAX)
 		histogram = HIST_MAX;
 
@@ -1427,6 +1508,16 @@ static void process_options(int argc, char *argv[], int max_cpus)
 	if (aligned && secaligned)
 		error = 1;
 
+	if (isolate && setaffinity != AFFINITY_SPECIFIED) {
+		warn("--isolate requires -a CPUSET\n");
+		error = 1;
+	}
+
+	if (steer_irqs && setaffinity != AFFINITY_SPECIFIED) {
+		warn("--steer-irqs requires -a CPUSET\n");
+		error = 1;
+	}
+
 	if (aligned || secaligned) {
 		pthread_barrier_init(&globalt_barr, NULL, num_threads);
 		pthread_barrier_init(&align_barr, NULL, num_threads);
@@ -1481,8 +1572,74 @@ static void sighand(int sig)
 		return;
 	}
 	shutdown = 1;
-	if (refresh_on_max)
-		pthread_cond_signal(&refresh_on_max_cond);
+	status_wakeup();
+}
+
+/*
+ * Render the periodic status screen. Lines which did not change since
+ * the last update are skipped by just moving the cursor down, and the
+ * whole frame goes out with a single write(2) to keep the footprint on
+ * the housekeeping CPU small.
+ */
+static void print_status(struct thread_param *par[], int nthreads)
+{
+	static char (*lines)[STATUS_LINE_SIZE];
+	static char *frame;
+	static size_t frame_size;
+	static char *policystr, *policystr2, *slash;
+	char line[STATUS_LINE_SIZE];
+	char lavg[256];
+	size_t len = 0;
+	ssize_t n;
+	int fd, i;
+
+	if (!frame) {
+		frame_size = 512 + nthreads * (STATUS_LINE_SIZE + 8);
+		frame = malloc(frame_size);
+		lines = calloc(nthreads, sizeof(*lines));
+		if (!frame || !lines)
+			fatal("failed to allocate status buffer\n");
+
+		policystr = policyname(policy);
+		if (force_sched_other) {
+			slash = "/";
+			policystr2 = policyname(SCHED_OTHER);
+		} else
+			slash = policystr2 = "";
+	} else {
+		len += sprintf(frame, "\033[%dA", nthreads + 2);
+	}
+
+	lavg[0] = 0x0;
+	fd = open("/proc/loadavg", O_RDONLY);
+	if (fd >= 0) {
+		n = read(fd, lavg, sizeof(lavg) - 1);
+		if (n > 0)
+			lavg[n - 1] = 0x0;
+		close(fd);
+	}
+	len += snprintf(frame + len, frame_size - len,
+			"policy: %s%s%s: loadavg: %s          \n\n",
+			policystr, slash, policystr2, lavg);
+
+	for (i = 0; i < nthreads; i++) {
+		snprint_stat(line, sizeof(line), par[i], i);
+		if (lines[i][0] && !strcmp(line, lines[i])) {
+			frame[len++] = '\n';
+			continue;
+		}
+		strcpy(lines[i], line);
+		len += snprintf(frame + len, frame_size - len, "%s\033[K\n",
+				line);
+	}
+
+	/* don't overtake anything still sitting in the stdio buffer */
+	fflush(stdout);
+	for (i = 0; i < len; i += n) {
+		n = write(STDOUT_FILENO, frame + i, len - i);
+		if (n <= 0)
+			break;
+	}
 }
 
 static void print_tids(struct thread_param *par[], int nthreads)
@@ -1570,29 +1727,42 @@ static void print_hist(struct thread_param *par[], int nthreads)
 		fclose(fd);
 }
 
+/* Format the status line of one thread, without trailing newline */
+static int snprint_stat(char *buf, size_t size, struct thread_param *par, int index)
+{
+	struct thread_stat *stat = par->stats;
+	char *fmt;
+	int len;
+
+	if (use_nsecs)
+		fmt = "T:%2d (%5d) P:%2d I:%ld C:%7lu "
+			"Min:%7ld Act:%8ld Avg:%8ld Max:%8ld";
+	else
+		fmt = "T:%2d (%5d) P:%2d I:%ld C:%7lu "
+			"Min:%7ld Act:%5ld Avg:%5ld Max:%8ld";
+
+	len = snprintf(buf, size, fmt, index, stat->tid, par->prio,
+		       par->interval, stat->cycles, stat->min,
+		       stat->act, stat->cycles ?
+		       (long)(stat->avg/stat->cycles) : 0, stat->max);
+
+	if (smi && len < size)
+		len += snprintf(buf + len, size - len, " SMI:%8ld",
+				stat->smi_count);
+
+	return len < size ? len : size - 1;
+}
+
 static void print_stat(FILE *fp, struct thread_param *par, int index, int verbose, int quiet)
 {
 	struct thread_stat *stat = par->stats;
 
 	if (!verbose) {
 		if (quiet != 1) {
-			char *fmt;
-			if (use_nsecs)
-				fmt = "T:%2d (%5d) P:%2d I:%ld C:%7lu "
-				        "Min:%7ld Act:%8ld Avg:%8ld Max:%8ld";
-			else
-				fmt = "T:%2d (%5d) P:%2d I:%ld C:%7lu "
-				        "Min:%7ld Act:%5ld Avg:%5ld Max:%8ld";
-
-			fprintf(fp, fmt, index, stat->tid, par->prio,
-				par->interval, stat->cycles, stat->min,
-				stat->act, stat->cycles ?
-				(long)(stat->avg/stat->cycles) : 0, stat->max);
-
-			if (smi)
-				fprintf(fp, " SMI:%8ld", stat->smi_count);
+			char line[STATUS_LINE_SIZE];
 
-			fprintf(fp, "\n");
+			snprint_stat(line, sizeof(line), par, index);
+			fprintf(fp, "%s\n", line);
 		}
 	} else {
 		while (stat->cycles != stat->cyclesread) {
@@ -1883,6 +2053,8 @@ static void write_stats(FILE *f, void *data)
 			fprintf(f, "      \"histogram\": {");
 			hist_print_json(s->hist, f);
 			fprintf(f, "      },\n");
+			fprintf(f, "      \"overflows\": %lu,\n",
+				s->hist->oflow_count);
 		}
 		fprintf(f, "      \"cycles\": %ld,\n", s->cycles);
 		fprintf(f, "      \"min\": %ld,\n", s->min);
@@ -1916,6 +2088,7 @@ int main(int argc, char **argv)
 	int online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
 	int i, ret = -1;
 	int status;
+	int timeout;
 
 	rt_init(argc, argv);
 	process_options(argc, argv, max_cpus);
@@ -1923,13 +2096,29 @@ int main(int argc, char **argv)
 	if (check_privs())
 		exit(EXIT_FAILURE);
 
+	if (isolate || steer_irqs) {
+		cpu_set_t set;
+		char cpus[4096];
+
+		cpumask_to_cpuset(affinity_mask, &set);
+		if (format_cpulist(&set, cpus, sizeof(cpus)) < 0)
+			fatal("Could not format the CPU list\n");
+		if (isolate && cgroup_isolate(cpus, CGROUP_ISOLATED))
+			fatal("Could not isolate CPUs\n");
+		if (steer_irqs && irq_steer_away(cpus) < 0)
+			fatal("Could not steer IRQs away from the measurement CPUs\n");
+	}
+
+
 	if (verbose) {
 		printf("Max CPUs = %d\n", max_cpus);
 		printf("Online CPUs = %d\n", online_cpus);
 	}
 
 	if (affinity_mask != NULL) {
-		set_main_thread_affinity(affinity_mask);
+		/* with --isolate only the measurement threads may go there */
+		if (!isolate)
+			set_main_thread_affinity(affinity_mask);
 		if (verbose)
 			printf("Using %u cpus.\n",
 				numa_bitmask_weight(affinity_mask));
@@ -2085,6 +2274,11 @@ int main(int argc, char **argv)
 	/* Set-up shm */
 	rstat_setup();
 
+	status_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (status_efd < 0)
+		warn("eventfd failed, falling back to polling: %s\n",
+		     strerror(errno));
+
 	if (histogram && hset_init(&hset, num_threads, 1, histogram, histogram))
 		fatal("failed to allocate histogram of size %d for %d threads\n",
 		      histogram, num_threads);
@@ -2227,52 +2421,36 @@ int main(int argc, char **argv)
 			fatal("failed to create fifo thread: %s\n", strerror(status));
 	}
 
-	while (!shutdown) {
-		char lavg[256];
-		int fd, len, allstopped = 0;
-		static char *policystr = NULL;
-		static char *slash = NULL;
-		static char *policystr2;
-
-		if (!policystr)
-			policystr = policyname(policy);
-
-		if (!slash) {
-			if (force_sched_other) {
-				slash = "/";
-				policystr2 = policyname(SCHED_OTHER);
-			} else
-				slash = policystr2 = "";
-		}
-		if (!verbose && !quiet) {
-			fd = open("/proc/loadavg", O_RDONLY, 0666);
-			len = read(fd, &lavg, 255);
-			close(fd);
-			lavg[len-1] = 0x0;
-			printf("policy: %s%s%s: loadavg: %s          \n\n",
-			       policystr, slash, policystr2, lavg);
-		}
+	/*
+	 * Without anything to print the main thread only has to wait for
+	 * the measurement threads or a signal to tell it the run is over.
+	 */
+	if (refresh_on_max || (quiet && !verbose))
+		timeout = -1;
+	else
+		timeout = refresh;
 
-		for (i = 0; i < num_threads; i++) {
+	for (;;) {
+		int allstopped = 0;
+
+		if (!verbose && !quiet)
+			print_status(parameters, num_threads);
 
-			print_stat(stdout, parameters[i], i, verbose, quiet);
+		for (i = 0; i < num_threads; i++) {
+			if (verbose)
+				print_stat(stdout, parameters[i], i, verbose, quiet);
 			if (max_cycles && statistics[i]->cycles >= max_cycles)
 				allstopped++;
 		}
 
-		usleep(10000);
 		if (shutdown || allstopped)
 			break;
-		if (!verbose && !quiet)
-			printf("\033[%dA", num_threads + 2);
-
-		if (refresh_on_max) {
-			pthread_mutex_lock(&refresh_on_max_lock);
-			if (!shutdown)
-				pthread_cond_wait(&refresh_on_max_cond,
-						&refresh_on_max_lock);
-			pthread_mutex_unlock(&refresh_on_max_lock);
-		}
+
+		status_wait(timeout);
+
+		/* let a burst of new maxima end up in a single redraw */
+		if (refresh_on_max && !shutdown)
+			usleep(refresh);
 	}
 	ret = EXIT_SUCCESS;
 
@@ -2280,9 +2458,6 @@ int main(int argc, char **argv)
 	shutdown = 1;
 	usleep(50000);
 
-	if (!verbose && !quiet && refresh_on_max)
-		printf("\033[%dB", num_threads + 2);
-
 	if (strlen(jsonfile) != 0)
 		rt_write_json(jsonfile, ret, write_stats, NULL);
 
@@ -2293,7 +2468,7 @@ int main(int argc, char **argv)
 			pthread_kill(statistics[i]->thread, SIGTERM);
 		if (statistics[i]->threadstarted) {
 			pthread_join(statistics[i]->thread, NULL);
-			if (quiet && !histogram)
+			if (quiet && !silent && !histogram)
 				print_stat(stdout, parameters[i], i, 0, 0);
 		}
 		if (statistics[i]->values)
@@ -2352,6 +2527,9 @@ int main(int argc, char **argv)
 	if (affinity_mask)
 		rt_bitmask_free(affinity_mask);
 
+	if (status_efd >= 0)
+		close(status_efd);
+
 	/* Remove running status shared memory file if it exists */
 	if (rstat_fd >= 0)
 		shm_unlink(shm_name);
@@ -25,7 +25,6 @@
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <sys/time.h>
-#include <sys/poll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <limits.h>
@@ -33,12 +32,30 @@
 #include <signal.h>
 #include <setjmp.h>
 #include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/prctl.h>
+#include <sys/poll.h>
+#include <sys/resource.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+
+#include "histogram.h"
+#include "rt-utils.h"
+#include "rt-numa.h"
 
 static unsigned int datasize = 100;
 static unsigned int loops = 100;
 static unsigned int num_groups = 10;
 static unsigned int num_fds = 20;
 static unsigned int fifo = 0;
+static int duration = 0;		/* seconds, run this long instead of loops */
+static unsigned int rate = 0;		/* messages per second per sender */
 
 /*
  * 0 means thread mode and others mean process (default)
@@ -51,18 +68,163 @@ static unsigned int process_mode = PROCESS_MODE;
 static int use_pipes = 0;
 static int use_inet = 0;
 
+enum transport {
+	TRANSPORT_SOCKET,
+	TRANSPORT_PIPE,
+	TRANSPORT_INET,
+	TRANSPORT_MMSG,
+	TRANSPORT_SPLICE,
+	TRANSPORT_EVENTFD,
+	TRANSPORT_URING,
+	NR_TRANSPORTS,
+};
+
+static const char * const transport_names[NR_TRANSPORTS] = {
+	[TRANSPORT_SOCKET]	= "socket",
+	[TRANSPORT_PIPE]	= "pipe",
+	[TRANSPORT_INET]	= "inet",
+	[TRANSPORT_MMSG]	= "mmsg",
+	[TRANSPORT_SPLICE]	= "splice",
+	[TRANSPORT_EVENTFD]	= "eventfd",
+	[TRANSPORT_URING]	= "io_uring",
+};
+
+enum placement {
+	PLACE_FLOAT,
+	PLACE_SPREAD,
+	PLACE_PAIR,
+	PLACE_SPLIT,
+	NR_PLACEMENTS,
+};
+
+static const char * const placement_names[NR_PLACEMENTS] = {
+	[PLACE_FLOAT]	= "float",
+	[PLACE_SPREAD]	= "spread",
+	[PLACE_PAIR]	= "pair",
+	[PLACE_SPLIT]	= "split",
+};
+
+static enum placement placement = PLACE_FLOAT;
+static struct bitmask *affinity_mask;	/* -a and -N, NULL if not restricted */
+static int numa_node = -1;
+static int max_cpus;
+static int place_nodes[CPU_SETSIZE];	/* nodes with allowed CPUs */
+static int nr_place_nodes;
+
+static enum transport transport = TRANSPORT_SOCKET;
+static unsigned int batch = 16;		/* messages per syscall, mmsg and io_uring */
+static unsigned int fanout;		/* receivers of each sender, 0 for all */
+static int pingpong;
+
+enum size_dist {
+	SIZE_FIXED,
+	SIZE_UNIFORM,
+	SIZE_BIMODAL,
+	SIZE_FILE,
+};
+
+static enum size_dist size_dist = SIZE_FIXED;
+static const char *size_arg;
+static unsigned int size_min, size_max;	/* uniform range, bimodal sizes */
+static unsigned int size_pct;		/* bimodal: percentage of large ones */
+static unsigned int *size_table;	/* file: sizes to pick from */
+static unsigned int size_table_len;
+static unsigned int msg_max;		/* largest message */
+
+/*
+ * Messages start with a header when their size varies or with
+ * --pingpong. Fixed size messages only carry the send time of --latency.
+ */
+struct msg_hdr {
+	uint64_t stamp;			/* CLOCK_MONOTONIC, ns */
+	uint32_t len;			/* including the header */
+	uint32_t flags;
+};
+
+#define MSG_BYE		1		/* --pingpong: close the connection */
+
+static int framed;
+
+/*
+ * With --latency every message starts with its CLOCK_MONOTONIC send time,
+ * and the receivers of each group sum up the delivery latencies in a
+ * group_stats record in memory shared by all workers.
+ */
+static unsigned int latency_us = 0;
+
+struct group_stats {
+	uint64_t messages;
+	uint64_t bytes;
+	uint64_t min;			/* ns */
+	uint64_t max;			/* ns */
+	uint64_t sum;			/* ns */
+	uint64_t oflows;		/* beyond the last bucket */
+	uint64_t end;			/* last message received, ns */
+	uint64_t senders_done;		/* --duration */
+	uint64_t buckets[];		/* latency_us buckets of 1us */
+};
+
+static char *stats_area;
+static size_t stats_stride;
+
+/*
+ * Start gate in the shared memory: the workers count themselves in
+ * ready and sleep on go, a futex each, until the main thread opens it.
+ */
+struct run_control {
+	uint64_t start;			/* senders released, ns */
+	uint32_t ready;
+	uint32_t go;
+};
+
+static struct run_control *ctl;
+static unsigned int total_workers;
+
+/* Messages and bytes taken by each receiver so far, one cache line apart */
+#define RECV_SLOT	8
+static uint64_t *received;
+
+/*
+ * With --usage the CPU time and scheduler statistics of every worker,
+ * in the order of child_tab. Process mode workers are accounted when
+ * they are reaped, threads record themselves before they return.
+ */
+struct worker_usage {
+	uint64_t utime;			/* ns */
+	uint64_t stime;			/* ns */
+	uint64_t nvcsw;
+	uint64_t nivcsw;
+	uint64_t run;			/* ns on the CPU, schedstat */
+	uint64_t wait;			/* ns on a runqueue, schedstat */
+	uint64_t migrations;
+	unsigned int flags;
+};
+
+#define USAGE_SCHEDSTAT		1
+#define USAGE_MIGRATIONS	2
+
+static int usage_stats;
+static struct worker_usage *usage;
+
+/* Added by the last sender of a group, the receivers' end of file */
+#define EVENTFD_EOF	(1ULL << 62)
+
 struct sender_context {
 	unsigned int num_fds;
-	int ready_out;
-	int wakefd;
+	unsigned int group;
+	unsigned int nr;
+	int *group_fds;			/* write ends of all receivers */
 	int out_fds[0];
 };
 
 struct receiver_context {
-	unsigned int num_packets;
+	uint64_t num_packets;
+	unsigned int group;
+	unsigned int nr;
+	uint64_t *received;
 	int in_fds[2];
-	int ready_out;
-	int wakefd;
+	unsigned int num_conns;		/* --pingpong */
+	int conns[0];
 };
 
 
@@ -97,15 +259,38 @@ static void print_usage_exit(int error)
 	printf("hackbench V %1.2f\n", VERSION);
 	printf("Usage:\n"
 	       "hackbench <options>\n\n"
+	       "-a       --affinity=CPUS   run the workers on the CPU set CPUS only\n"
+	       "-b       --batch=NUM       messages per system call of the mmsg and\n"
+	       "                           io_uring transports, default 16\n"
+	       "-D       --duration=TIME   send for TIME instead of LOOPS messages, and\n"
+	       "                           print the throughput every second\n"
 	       "-f       --fds=NUM         number of fds\n"
 	       "-F       --fifo            use SCHED_FIFO for main thread\n"
 	       "-g       --groups=NUM      number of groups to be used\n"
 	       "-h       --help            print this message\n"
 	       "-l       --loops=LOOPS     how many message should be send\n"
+	       "-L       --latency=US      measure the message latency, with a histogram\n"
+	       "                           up to US, and the throughput of every group\n"
+	       "-m       --placement=POL   where to run the workers: float (default),\n"
+	       "                           spread (groups round robin over the NUMA nodes),\n"
+	       "                           pair (sender and receiver N share a CPU) or\n"
+	       "                           split (senders and receivers on different nodes)\n"
+	       "-N       --node=NODE       run the workers on the CPUs of NUMA node NODE\n"
+	       "-o       --fanout=NUM      receivers each sender sends to, default all\n"
 	       "-p       --pipe            send data via a pipe\n"
+	       "-r       --rate=NUM        messages per second of each sender\n"
+	       "-R       --pingpong        wait for a response to every message\n"
 	       "-i       --inet            send data via a inet tcp connection\n"
 	       "-s       --datasize=SIZE   message size\n"
+	       "-S       --sizes=DIST      message sizes: fixed (default, see -s),\n"
+	       "                           uniform:MIN-MAX, bimodal:SMALL,LARGE,PCT\n"
+	       "                           (PCT percent large ones) or file:PATH\n"
+	       "-t       --transport=TYPE  socket (default), pipe, inet, mmsg (packets\n"
+	       "                           with sendmmsg/recvmmsg), splice (vmsplice into\n"
+	       "                           pipes), eventfd (no data) or io_uring\n"
 	       "-T       --threads         use POSIX threads\n"
+	       "-u       --usage           print the CPU time, context switches and\n"
+	       "                           scheduler delays of the workers per group\n"
 	       "-P       --process         use fork (default)\n"
 	       );
 	exit(error);
@@ -151,117 +336,1373 @@ static int inet_socketpair(int fds[2])
 	return 0;
 }
 
-static void fdpair(int fds[2])
+static void fdpair(int fds[2])
+{
+	switch (transport) {
+	case TRANSPORT_PIPE:
+	case TRANSPORT_SPLICE:
+		if (pipe(fds) == 0)
+			return;
+		break;
+	case TRANSPORT_INET:
+		if (inet_socketpair(fds) == 0)
+			return;
+		break;
+	case TRANSPORT_MMSG:
+	case TRANSPORT_URING:
+		if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == 0)
+			return;
+		break;
+	case TRANSPORT_EVENTFD:
+		/* two descriptors, so either end can be closed */
+		fds[0] = eventfd(0, 0);
+		if (fds[0] >= 0 && (fds[1] = dup(fds[0])) >= 0)
+			return;
+		break;
+	default:
+		/* senders share the receivers' sockets, keep messages whole */
+		if (socketpair(AF_UNIX, framed ? SOCK_SEQPACKET : SOCK_STREAM,
+			       0, fds) == 0)
+			return;
+		break;
+	}
+	barf("Creating fdpair");
+}
+
+static inline void futex_wait(uint32_t *addr, uint32_t val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static inline void futex_wake(uint32_t *addr, int nr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, nr, NULL, NULL, 0);
+}
+
+/* Block until we're ready to go */
+static void ready(void)
+{
+	/* Tell them we're ready, the last one wakes the main thread */
+	if (__atomic_add_fetch(&ctl->ready, 1, __ATOMIC_ACQ_REL) == total_workers)
+		futex_wake(&ctl->ready, 1);
+
+	/* Wait for "GO" signal */
+	while (!__atomic_load_n(&ctl->go, __ATOMIC_ACQUIRE))
+		futex_wait(&ctl->go, 0);
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * (uint64_t)NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static struct group_stats *group_stats(unsigned int group)
+{
+	return (struct group_stats *)(stats_area + group * stats_stride);
+}
+
+static void atomic_min(uint64_t *p, uint64_t val)
+{
+	uint64_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+	while (val < old && !__atomic_compare_exchange_n(p, &old, val, 0,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static void atomic_max(uint64_t *p, uint64_t val)
+{
+	uint64_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+	while (val > old && !__atomic_compare_exchange_n(p, &old, val, 0,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/* Shared, so process mode workers can report back */
+static void stats_init(void)
+{
+	unsigned int i;
+
+	stats_stride = sizeof(struct group_stats) +
+		latency_us * sizeof(uint64_t);
+	stats_area = mmap(NULL, 64 + num_groups * stats_stride +
+			  num_groups * num_fds * RECV_SLOT * sizeof(uint64_t) +
+			  total_workers * sizeof(struct worker_usage),
+			  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+			  -1, 0);
+	if (stats_area == MAP_FAILED)
+		barf("mmap");
+	ctl = (struct run_control *)stats_area;
+	stats_area += 64;
+	received = (uint64_t *)(stats_area + num_groups * stats_stride);
+	usage = (struct worker_usage *)(received + num_groups * num_fds * RECV_SLOT);
+
+	for (i = 0; i < num_groups; i++)
+		group_stats(i)->min = UINT64_MAX;
+}
+
+/* Fold the histogram of one receiver into its group */
+static void stats_merge(unsigned int group, struct histogram *h,
+			uint64_t min, uint64_t max, uint64_t sum, uint64_t bytes,
+			uint64_t end)
+{
+	struct group_stats *gs = group_stats(group);
+	unsigned long i;
+
+	for (i = 0; i < h->num; i++)
+		if (h->buckets[i])
+			__atomic_fetch_add(&gs->buckets[i], h->buckets[i],
+					   __ATOMIC_RELAXED);
+	__atomic_fetch_add(&gs->messages, h->events, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&gs->bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&gs->oflows, h->oflow_count, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&gs->sum, sum, __ATOMIC_RELAXED);
+	atomic_min(&gs->min, min);
+	atomic_max(&gs->max, max);
+	atomic_max(&gs->end, end);
+}
+
+/* Latency in us below which fraction p of the messages arrived */
+static double stats_percentile(struct group_stats *gs, double p)
+{
+	uint64_t want = gs->messages * p, seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < latency_us; i++) {
+		seen += gs->buckets[i];
+		if (seen >= want && seen)
+			return i + 1;
+	}
+
+	/* in the overflows, all we know is the maximum */
+	return gs->max / 1000.0;
+}
+
+static void stats_print_one(const char *name, struct group_stats *gs)
+{
+	double secs = (gs->end - ctl->start) / 1e9;
+
+	if (!gs->messages || secs <= 0) {
+		printf("%-6s %10s\n", name, "-");
+		return;
+	}
+
+	printf("%-6s %10llu %12.0f %10.2f %8.1f %8.1f %8.0f %8.0f %8.0f %8.1f\n",
+	       name, (unsigned long long)gs->messages, gs->messages / secs,
+	       gs->bytes / secs / 1e6, gs->min / 1000.0,
+	       gs->sum / 1000.0 / gs->messages, stats_percentile(gs, 0.5),
+	       stats_percentile(gs, 0.99), stats_percentile(gs, 0.999),
+	       gs->max / 1000.0);
+}
+
+static void stats_print(void)
+{
+	struct group_stats *all;
+	struct group_stats *gs;
+	unsigned int i, j;
+	char name[16];
+
+	all = calloc(1, stats_stride);
+	if (!all)
+		barf("main:malloc()");
+	all->min = UINT64_MAX;
+
+	printf("%-6s %10s %12s %10s %8s %8s %8s %8s %8s %8s\n", "Group",
+	       "Messages", "Msgs/s", "MB/s", "Min(us)", "Avg(us)", "P50(us)",
+	       "P99(us)", "P99.9", "Max(us)");
+	for (i = 0; i < num_groups; i++) {
+		gs = group_stats(i);
+		snprintf(name, sizeof(name), "%u", i);
+		stats_print_one(name, gs);
+
+		for (j = 0; j < latency_us; j++)
+			all->buckets[j] += gs->buckets[j];
+		all->messages += gs->messages;
+		all->bytes += gs->bytes;
+		all->oflows += gs->oflows;
+		all->sum += gs->sum;
+		if (gs->min < all->min)
+			all->min = gs->min;
+		if (gs->max > all->max)
+			all->max = gs->max;
+		if (gs->end > all->end)
+			all->end = gs->end;
+	}
+	stats_print_one("All", all);
+	if (all->oflows)
+		printf("%llu messages took longer than %u us\n",
+		       (unsigned long long)all->oflows, latency_us);
+	free(all);
+}
+
+/* Messages, or with bytes set their bytes, of all receivers */
+static uint64_t total_received(int bytes)
+{
+	uint64_t sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < num_groups * num_fds; i++)
+		sum += __atomic_load_n(&received[i * RECV_SLOT + bytes],
+				       __ATOMIC_RELAXED);
+	return sum;
+}
+
+/* With --duration, print the throughput of every second until the end */
+static void report_loop(void)
+{
+	uint64_t start = ctl->start, end, next, now, prev = start;
+	uint64_t msgs, prev_msgs = 0, bytes, prev_bytes = 0;
+	struct timespec ts;
+	double secs;
+
+	end = start + (uint64_t)duration * NSEC_PER_SEC;
+	for (next = start; next < end;) {
+		next += NSEC_PER_SEC;
+		if (next > end)
+			next = end;
+		ts.tv_sec = next / NSEC_PER_SEC;
+		ts.tv_nsec = next % NSEC_PER_SEC;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+
+		now = now_ns();
+		msgs = total_received(0);
+		bytes = total_received(1);
+		secs = (now - prev) / 1e9;
+		printf("%8.1fs %12.0f msgs/s %10.2f MB/s\n", (now - start) / 1e9,
+		       (msgs - prev_msgs) / secs,
+		       (bytes - prev_bytes) / secs / 1e6);
+		fflush(stdout);
+		prev = now;
+		prev_msgs = msgs;
+		prev_bytes = bytes;
+	}
+}
+
+static struct worker_usage *worker_usage(unsigned int group, unsigned int nr,
+					 int is_sender)
+{
+	return &usage[(group * 2 + is_sender) * num_fds + nr];
+}
+
+static void usage_rusage(struct worker_usage *wu, const struct rusage *ru)
+{
+	wu->utime = ru->ru_utime.tv_sec * (uint64_t)NSEC_PER_SEC +
+		ru->ru_utime.tv_usec * 1000ULL;
+	wu->stime = ru->ru_stime.tv_sec * (uint64_t)NSEC_PER_SEC +
+		ru->ru_stime.tv_usec * 1000ULL;
+	wu->nvcsw = ru->ru_nvcsw;
+	wu->nivcsw = ru->ru_nivcsw;
+}
+
+/*
+ * Run and runqueue wait time from the schedstat file of the task in dir,
+ * the migrations from its sched file, which needs CONFIG_SCHED_DEBUG.
+ */
+static void usage_sched(const char *dir, struct worker_usage *wu)
+{
+	unsigned long long run, wait, migrations;
+	char path[64], line[256], *colon;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/schedstat", dir);
+	f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "%llu %llu", &run, &wait) == 2) {
+			wu->run = run;
+			wu->wait = wait;
+			wu->flags |= USAGE_SCHEDSTAT;
+		}
+		fclose(f);
+	}
+
+	snprintf(path, sizeof(path), "%s/sched", dir);
+	f = fopen(path, "r");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		colon = strchr(line, ':');
+		if (!strncmp(line, "se.nr_migrations", 16) && colon &&
+		    sscanf(colon + 1, "%llu", &migrations) == 1) {
+			wu->migrations = migrations;
+			wu->flags |= USAGE_MIGRATIONS;
+			break;
+		}
+	}
+	fclose(f);
+}
+
+/* A thread is gone after it returned, so it accounts itself */
+static void usage_thread(struct worker_usage *wu)
+{
+	struct rusage ru;
+
+	if (!usage_stats || process_mode != THREAD_MODE)
+		return;
+	usage_sched("/proc/thread-self", wu);
+	if (getrusage(RUSAGE_THREAD, &ru) == 0)
+		usage_rusage(wu, &ru);
+}
+
+/* Reap one worker process, its /proc files stay until then */
+static pid_t wait_usage(int *status)
+{
+	struct worker_usage *wu = NULL;
+	struct rusage ru;
+	siginfo_t info;
+	char dir[32];
+	unsigned int i;
+	pid_t pid;
+
+	info.si_pid = 0;
+	if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) < 0)
+		return -1;
+
+	for (i = 0; i < total_workers; i++)
+		if (child_tab[i].pid == info.si_pid)
+			wu = &usage[i];
+	if (wu) {
+		snprintf(dir, sizeof(dir), "/proc/%d", info.si_pid);
+		usage_sched(dir, wu);
+	}
+
+	pid = wait4(info.si_pid, status, 0, &ru);
+	if (pid > 0 && wu)
+		usage_rusage(wu, &ru);
+	return pid;
+}
+
+static void usage_print_one(const char *name, struct worker_usage *wu)
+{
+	printf("%-6s %9.3f %9.3f %10llu %10llu", name, wu->utime / 1e9,
+	       wu->stime / 1e9, (unsigned long long)wu->nvcsw,
+	       (unsigned long long)wu->nivcsw);
+	if (wu->flags & USAGE_SCHEDSTAT)
+		printf(" %9.3f %9.3f %6.1f", wu->run / 1e9, wu->wait / 1e9,
+		       wu->run + wu->wait ?
+		       100.0 * wu->wait / (wu->run + wu->wait) : 0.0);
+	else
+		printf(" %9s %9s %6s", "-", "-", "-");
+	if (wu->flags & USAGE_MIGRATIONS)
+		printf(" %10llu\n", (unsigned long long)wu->migrations);
+	else
+		printf(" %10s\n", "-");
+}
+
+static void usage_add(struct worker_usage *sum, struct worker_usage *wu)
+{
+	sum->utime += wu->utime;
+	sum->stime += wu->stime;
+	sum->nvcsw += wu->nvcsw;
+	sum->nivcsw += wu->nivcsw;
+	sum->run += wu->run;
+	sum->wait += wu->wait;
+	sum->migrations += wu->migrations;
+	sum->flags &= wu->flags;
+}
+
+/* The sums of the senders and receivers of each group and of all groups */
+static void usage_print(void)
+{
+	struct worker_usage all = { .flags = USAGE_SCHEDSTAT | USAGE_MIGRATIONS };
+	struct worker_usage gu;
+	unsigned int i, j;
+	char name[16];
+
+	printf("%-6s %9s %9s %10s %10s %9s %9s %6s %10s\n", "Group",
+	       "User(s)", "Sys(s)", "Vol-CS", "Invol-CS", "Run(s)",
+	       "Wait(s)", "Wait%", "Migrations");
+	for (i = 0; i < num_groups; i++) {
+		memset(&gu, 0, sizeof(gu));
+		gu.flags = all.flags;
+		for (j = 0; j < num_fds * 2; j++)
+			usage_add(&gu, &usage[i * num_fds * 2 + j]);
+		snprintf(name, sizeof(name), "%u", i);
+		usage_print_one(name, &gu);
+		usage_add(&all, &gu);
+	}
+	usage_print_one("All", &all);
+}
+
+static void reset_worker_signals(void)
+{
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+}
+
+/* One ring per worker, every transfer is submitted and reaped in batches */
+struct uring {
+	int fd;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned int queued;
+};
+
+static void uring_init(struct uring *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	size_t sq_size, cq_size;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		barf("io_uring_setup");
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP && cq_size > sq_size)
+		sq_size = cq_size;
+
+	sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		barf("mmap io_uring");
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			barf("mmap io_uring");
+	}
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		barf("mmap io_uring");
+
+	r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	r->queued = 0;
+}
+
+static void uring_queue(struct uring *r, int op, int fd, void *buf,
+			unsigned int len, uint64_t user_data)
+{
+	unsigned int tail = *r->sq_tail;
+	unsigned int idx = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->user_data = user_data;
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->queued++;
+}
+
+/* Submit everything queued and wait until all of it has completed */
+static void uring_submit_wait(struct uring *r)
+{
+	unsigned int submitted = 0;
+	int ret;
+
+	while (submitted < r->queued) {
+		ret = syscall(__NR_io_uring_enter, r->fd,
+			      r->queued - submitted, r->queued - submitted,
+			      IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0 && errno != EINTR)
+			barf("io_uring_enter");
+		if (ret > 0)
+			submitted += ret;
+	}
+	while (__atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) - *r->cq_head <
+	       r->queued) {
+		ret = syscall(__NR_io_uring_enter, r->fd, 0, r->queued,
+			      IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0 && errno != EINTR)
+			barf("io_uring_enter");
+	}
+}
+
+/* Next completion of the last submission, NULL once all are consumed */
+static struct io_uring_cqe *uring_reap(struct uring *r)
+{
+	unsigned int head = *r->cq_head;
+	struct io_uring_cqe *cqe;
+
+	if (!r->queued)
+		return NULL;
+
+	cqe = &r->cqes[head & *r->cq_mask];
+	__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+	r->queued--;
+	return cqe;
+}
+
+static inline int keep_sending(unsigned int i)
+{
+	if (duration)
+		return now_ns() < ctl->start + (uint64_t)duration * NSEC_PER_SEC;
+	return i < loops;
+}
+
+/* Messages the next call of a batching sender passes to one receiver */
+static inline unsigned int burst(unsigned int i)
+{
+	if (duration || loops - i > batch)
+		return batch;
+	return loops - i;
+}
+
+/* Wait for the time slot of the next n messages with --rate */
+static inline void pace(uint64_t *next, unsigned int n)
+{
+	struct timespec ts;
+
+	if (!rate)
+		return;
+	if (!*next)
+		*next = now_ns();
+	if (now_ns() < *next) {
+		ts.tv_sec = *next / NSEC_PER_SEC;
+		ts.tv_nsec = *next % NSEC_PER_SEC;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+	}
+	*next += n * (uint64_t)NSEC_PER_SEC / rate;
+}
+
+static inline uint64_t xorshift64(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+static uint64_t worker_seed(unsigned int group, unsigned int nr)
+{
+	return (now_ns() ^ ((uint64_t)group << 32 | nr)) | 1;
+}
+
+/* Size of the next message from the --sizes distribution */
+static unsigned int msg_size(uint64_t *seed)
+{
+	switch (size_dist) {
+	case SIZE_UNIFORM:
+		return size_min + xorshift64(seed) % (size_max - size_min + 1);
+	case SIZE_BIMODAL:
+		return xorshift64(seed) % 100 < size_pct ? size_max : size_min;
+	case SIZE_FILE:
+		return size_table[xorshift64(seed) % size_table_len];
+	default:
+		return datasize;
+	}
+}
+
+/* Put the header into the next message to send, returns its size */
+static inline unsigned int fill(char *data, uint64_t *seed)
+{
+	struct msg_hdr hdr;
+	uint64_t now;
+
+	if (framed) {
+		hdr.stamp = latency_us ? now_ns() : 0;
+		hdr.len = msg_size(seed);
+		hdr.flags = 0;
+		memcpy(data, &hdr, sizeof(hdr));
+		return hdr.len;
+	}
+
+	if (latency_us) {
+		now = now_ns();
+		memcpy(data, &now, sizeof(now));
+	}
+	return datasize;
+}
+
+/* Size of a received message with the header at data, 0 if it's broken */
+static inline unsigned int msg_len(const char *data)
+{
+	struct msg_hdr hdr;
+
+	if (!framed)
+		return datasize;
+	memcpy(&hdr, data, sizeof(hdr));
+	if (hdr.len < sizeof(hdr) || hdr.len > msg_max)
+		return 0;
+	return hdr.len;
+}
+
+static char *msg_buffers(unsigned int n)
+{
+	char *bufs = malloc((size_t)n * msg_max);
+
+	if (!bufs)
+		barf("malloc() [messages]");
+	memset(bufs, '-', (size_t)n * msg_max);
+	return bufs;
+}
+
+static void write_full(int fd, const char *data, size_t len)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len) {
+		ret = write(fd, data + done, len - done);
+		if (ret < 0)
+			barf("SENDER: write");
+		done += ret;
+	}
+}
+
+/* Returns 0 on end of file before the first byte */
+static int read_full(int fd, char *data, size_t len)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while (done < len) {
+		ret = read(fd, data + done, len - done);
+		if (ret == 0 && !done)
+			return 0;
+		if (ret <= 0)
+			barf("SERVER: read");
+		done += ret;
+	}
+	return 1;
+}
+
+/* Read one message from a stream, returns its size or 0 at end of file */
+static unsigned int read_msg(int fd, char *data)
+{
+	unsigned int len;
+	ssize_t ret;
+
+	/* framed messages of the socket transport come as packets */
+	if (framed && transport == TRANSPORT_SOCKET) {
+		ret = read(fd, data, msg_max);
+		if (ret == 0)
+			return 0;
+		if (ret < 0)
+			barf("SERVER: read");
+		len = ret >= sizeof(struct msg_hdr) ? msg_len(data) : 0;
+		if (len != ret) {
+			errno = EPROTO;
+			barf("SERVER: message header");
+		}
+		return len;
+	}
+
+	if (!read_full(fd, data, framed ? sizeof(struct msg_hdr) : datasize))
+		return 0;
+	len = msg_len(data);
+	if (!len) {
+		errno = EPROTO;
+		barf("SERVER: message header");
+	}
+	if (framed && len > sizeof(struct msg_hdr) &&
+	    !read_full(fd, data + sizeof(struct msg_hdr),
+		       len - sizeof(struct msg_hdr))) {
+		errno = EPIPE;
+		barf("SERVER: read");
+	}
+	return len;
+}
+
+static void send_stream(struct sender_context *ctx, char *data, uint64_t *seed)
+{
+	uint64_t next = 0;
+	unsigned int i, j, len;
+
+	for (i = 0; keep_sending(i); i++) {
+		for (j = 0; j < ctx->num_fds; j++) {
+			pace(&next, 1);
+			len = fill(data, seed);
+			write_full(ctx->out_fds[j], data, len);
+		}
+	}
+}
+
+/* Bursts of up to batch packets per receiver and sendmmsg() */
+static void send_mmsg(struct sender_context *ctx, char *data, uint64_t *seed)
+{
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	unsigned int i, j, k, n, done;
+	uint64_t next = 0;
+	char *bufs;
+	int ret;
+
+	msgs = calloc(batch, sizeof(*msgs));
+	iovs = calloc(batch, sizeof(*iovs));
+	if (!msgs || !iovs)
+		barf("SENDER: malloc");
+	bufs = msg_buffers(batch);
+	for (i = 0; i < batch; i++) {
+		iovs[i].iov_base = bufs + (size_t)i * msg_max;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (i = 0; keep_sending(i); i += n) {
+		n = burst(i);
+		for (j = 0; j < ctx->num_fds; j++) {
+			pace(&next, n);
+			for (k = 0; k < n; k++)
+				iovs[k].iov_len = fill(iovs[k].iov_base, seed);
+			for (done = 0; done < n; done += ret) {
+				ret = sendmmsg(ctx->out_fds[j], msgs + done,
+					       n - done, 0);
+				if (ret < 0)
+					barf("SENDER: sendmmsg");
+			}
+		}
+	}
+	free(bufs);
+	free(iovs);
+	free(msgs);
+}
+
+/*
+ * vmsplice() maps the buffer into the pipe instead of copying it, so a
+ * buffer must not be rewritten before the receiver has consumed it.
+ * Every message takes one of the pipe's slots, so a ring of one buffer
+ * more than the pipe has slots is safe for each receiver. A message
+ * crossing a page would take two slots and could be split up by other
+ * senders, so the buffers are aligned to a power of two.
+ */
+static void send_splice(struct sender_context *ctx, char *data, uint64_t *seed)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	unsigned int i, j, nbufs;
+	uint64_t next = 0;
+	char *bufs, *buf;
+	size_t stride;
+	int slots;
+
+	slots = fcntl(ctx->out_fds[0], F_GETPIPE_SZ);
+	if (slots < 0)
+		barf("SENDER: F_GETPIPE_SZ");
+	nbufs = slots / page + 1;
+
+	for (stride = 64; stride < msg_max; stride *= 2)
+		;
+	if (posix_memalign((void **)&bufs, page, ctx->num_fds * nbufs * stride))
+		barf("SENDER: malloc");
+	for (j = 0; j < ctx->num_fds * nbufs; j++)
+		memcpy(bufs + j * stride, data, msg_max);
+
+	for (i = 0; keep_sending(i); i++) {
+		for (j = 0; j < ctx->num_fds; j++) {
+			struct iovec iov;
+			ssize_t ret;
+
+			pace(&next, 1);
+			buf = bufs + (j * nbufs + i % nbufs) * stride;
+			iov.iov_base = buf;
+			iov.iov_len = fill(buf, seed);
+			while (iov.iov_len) {
+				ret = vmsplice(ctx->out_fds[j], &iov, 1, 0);
+				if (ret < 0)
+					barf("SENDER: vmsplice");
+				iov.iov_base = (char *)iov.iov_base + ret;
+				iov.iov_len -= ret;
+			}
+		}
+	}
+	/* the pipes may still hold the buffers, they go with the process */
+}
+
+/* A message is nothing but an increment of the receiver's counter */
+static void send_eventfd(struct sender_context *ctx, char *data, uint64_t *seed)
+{
+	uint64_t one = 1, next = 0;
+	unsigned int i, j;
+
+	for (i = 0; keep_sending(i); i++) {
+		for (j = 0; j < ctx->num_fds; j++) {
+			pace(&next, 1);
+			if (write(ctx->out_fds[j], &one, sizeof(one)) != sizeof(one))
+				barf("SENDER: eventfd write");
+		}
+	}
+}
+
+/* The messages in the order of send_stream(), batch per io_uring_enter() */
+static void send_uring_flush(struct uring *r, char *bufs)
+{
+	struct io_uring_cqe *cqe;
+
+	uring_submit_wait(r);
+	while ((cqe = uring_reap(r)))
+		if (cqe->res != (int)msg_len(bufs + cqe->user_data * msg_max)) {
+			errno = cqe->res < 0 ? -cqe->res : EMSGSIZE;
+			barf("SENDER: io_uring send");
+		}
+}
+
+static void send_uring(struct sender_context *ctx, char *data, uint64_t *seed)
+{
+	unsigned int i, j, len;
+	uint64_t next = 0;
+	struct uring r;
+	char *bufs, *buf;
+
+	uring_init(&r, batch);
+	bufs = msg_buffers(batch);
+
+	for (i = 0; keep_sending(i); i++) {
+		for (j = 0; j < ctx->num_fds; j++) {
+			if (!r.queued)
+				pace(&next, batch);
+			buf = bufs + (size_t)r.queued * msg_max;
+			len = fill(buf, seed);
+			uring_queue(&r, IORING_OP_SEND, ctx->out_fds[j], buf,
+				    len, r.queued);
+			if (r.queued == batch)
+				send_uring_flush(&r, bufs);
+		}
+	}
+	if (r.queued)
+		send_uring_flush(&r, bufs);
+	free(bufs);
+	close(r.fd);
+}
+
+/*
+ * With --duration the receivers can't count the messages, the last
+ * sender of the group closes their connections instead. In process mode
+ * exiting does that already, eventfds get their special increment.
+ */
+static void sender_done(struct sender_context *ctx)
+{
+	struct group_stats *gs = group_stats(ctx->group);
+	uint64_t eof = EVENTFD_EOF;
+	unsigned int j;
+
+	if (!duration ||
+	    __atomic_add_fetch(&gs->senders_done, 1, __ATOMIC_ACQ_REL) < num_fds)
+		return;
+
+	for (j = 0; j < num_fds; j++) {
+		if (transport == TRANSPORT_EVENTFD) {
+			if (write(ctx->group_fds[j], &eof, sizeof(eof)) != sizeof(eof))
+				barf("SENDER: eventfd write");
+		} else if (process_mode == THREAD_MODE) {
+			close(ctx->group_fds[j]);
+		}
+	}
+}
+
+/* Messages and their latency seen by one receiver */
+struct recv_stats {
+	struct histogram hist;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	uint64_t last;
+	uint64_t count;
+	uint64_t bytes;
+	uint64_t *received;
+};
+
+static inline void recv_count(struct recv_stats *rs, uint64_t n, uint64_t bytes)
+{
+	rs->count += n;
+	rs->bytes += bytes;
+	__atomic_store_n(&rs->received[0], rs->count, __ATOMIC_RELAXED);
+	__atomic_store_n(&rs->received[1], rs->bytes, __ATOMIC_RELAXED);
+}
+
+static inline void recv_sample(struct recv_stats *rs, const char *data,
+			       unsigned int len)
+{
+	uint64_t stamp, lat;
+
+	recv_count(rs, 1, len);
+	if (!latency_us)
+		return;
+
+	rs->last = now_ns();
+	memcpy(&stamp, data, sizeof(stamp));
+	lat = rs->last > stamp ? rs->last - stamp : 0;
+	if (lat < rs->min)
+		rs->min = lat;
+	if (lat > rs->max)
+		rs->max = lat;
+	rs->sum += lat;
+	hist_sample(&rs->hist, lat / 1000);
+}
+
+static void recv_stats_init(struct recv_stats *rs, uint64_t *received)
+{
+	memset(rs, 0, sizeof(*rs));
+	rs->min = UINT64_MAX;
+	rs->received = received;
+	if (latency_us && hist_init(&rs->hist, 1, latency_us))
+		barf("histogram");
+}
+
+static void recv_stats_done(struct recv_stats *rs, unsigned int group)
+{
+	if (!latency_us)
+		return;
+	stats_merge(group, &rs->hist, rs->min, rs->max, rs->sum, rs->bytes,
+		    rs->last);
+	hist_destroy(&rs->hist);
+}
+
+/*
+ * --pingpong: one request at a time to each receiver, which answers on
+ * the same connection. The latency is the round trip, a closing request
+ * ends each connection.
+ */
+static void send_pingpong(struct sender_context *ctx, char *data, uint64_t *seed)
+{
+	struct msg_hdr bye = { .len = sizeof(bye), .flags = MSG_BYE };
+	uint64_t next = 0, dummy[2];
+	unsigned int i, j, len;
+	struct recv_stats rtt;
+
+	recv_stats_init(&rtt, dummy);
+
+	for (i = 0; keep_sending(i); i++) {
+		for (j = 0; j < ctx->num_fds; j++) {
+			pace(&next, 1);
+			len = fill(data, seed);
+			write_full(ctx->out_fds[j], data, len);
+			len = read_msg(ctx->out_fds[j], data);
+			if (!len) {
+				errno = EPIPE;
+				barf("SENDER: response");
+			}
+			recv_sample(&rtt, data, len);
+		}
+	}
+
+	for (j = 0; j < ctx->num_fds; j++)
+		write_full(ctx->out_fds[j], (char *)&bye, sizeof(bye));
+
+	recv_stats_done(&rtt, ctx->group);
+}
+
+/* Sender sprays loops messages down each file descriptor */
+static void *sender(struct sender_context *ctx)
+{
+	uint64_t seed = worker_seed(ctx->group, ctx->nr);
+	char *data;
+
+	reset_worker_signals();
+	ready();
+	data = msg_buffers(1);
+
+	/* Now pump to every receiver. */
+	if (pingpong)
+		send_pingpong(ctx, data, &seed);
+	else switch (transport) {
+	case TRANSPORT_MMSG:
+		send_mmsg(ctx, data, &seed);
+		break;
+	case TRANSPORT_SPLICE:
+		send_splice(ctx, data, &seed);
+		break;
+	case TRANSPORT_EVENTFD:
+		send_eventfd(ctx, data, &seed);
+		break;
+	case TRANSPORT_URING:
+		send_uring(ctx, data, &seed);
+		break;
+	default:
+		send_stream(ctx, data, &seed);
+		break;
+	}
+	if (!pingpong)
+		sender_done(ctx);
+	free(data);
+	usage_thread(worker_usage(ctx->group, ctx->nr, 1));
+	free(ctx);
+	return NULL;
+}
+
+static void receive_stream(struct receiver_context *ctx, struct recv_stats *rs)
 {
-	if (use_pipes) {
-		if (pipe(fds) == 0)
-			return;
-	} else if (use_inet) {
-		if (inet_socketpair(fds) == 0)
-			return;
-	} else {
-		if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0)
-			return;
+	unsigned int len;
+	char *data;
+	uint64_t i;
+
+	data = msg_buffers(1);
+	for (i = 0; i < ctx->num_packets; i++) {
+		len = read_msg(ctx->in_fds[0], data);
+		if (!len)
+			break;
+		recv_sample(rs, data, len);
 	}
-	barf("Creating fdpair");
+	free(data);
 }
 
-/* Block until we're ready to go */
-static void ready(int ready_out, int wakefd)
+static void receive_mmsg(struct receiver_context *ctx, struct recv_stats *rs)
 {
-	char dummy = '*';
-	struct pollfd pollfd = { .fd = wakefd, .events = POLLIN };
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	uint64_t i, n;
+	char *bufs, *buf;
+	int ret, k;
+
+	msgs = calloc(batch, sizeof(*msgs));
+	iovs = calloc(batch, sizeof(*iovs));
+	if (!msgs || !iovs)
+		barf("SERVER: malloc");
+	bufs = msg_buffers(batch);
+	for (i = 0; i < batch; i++) {
+		iovs[i].iov_base = bufs + i * msg_max;
+		iovs[i].iov_len = msg_max;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (i = 0; i < ctx->num_packets; i += ret) {
+		n = ctx->num_packets - i < batch ? ctx->num_packets - i : batch;
+		ret = recvmmsg(ctx->in_fds[0], msgs, n, MSG_WAITFORONE, NULL);
+		if (ret < 0)
+			barf("SERVER: recvmmsg");
+		for (k = 0; k < ret; k++) {
+			buf = bufs + k * msg_max;
+			if (msgs[k].msg_len == 0)
+				goto out;
+			if ((framed && msgs[k].msg_len < sizeof(struct msg_hdr)) ||
+			    msgs[k].msg_len != msg_len(buf)) {
+				errno = EMSGSIZE;
+				barf("SERVER: recvmmsg");
+			}
+			recv_sample(rs, buf, msgs[k].msg_len);
+		}
+	}
+out:
+	free(bufs);
+	free(iovs);
+	free(msgs);
+}
 
-	/* Tell them we're ready. */
-	if (write(ready_out, &dummy, 1) != 1)
-		barf("CLIENT: ready write");
+/* Without --latency nobody looks at the data, so splice it away as well */
+static void receive_splice(struct receiver_context *ctx, struct recv_stats *rs)
+{
+	uint64_t i;
+	size_t done;
+	ssize_t ret;
+	int null;
+
+	if (latency_us || framed) {
+		receive_stream(ctx, rs);
+		return;
+	}
 
-	/* Wait for "GO" signal */
-	if (poll(&pollfd, 1, -1) != 1)
-		barf("poll");
+	null = open("/dev/null", O_WRONLY);
+	if (null < 0)
+		barf("SERVER: open /dev/null");
+	for (i = 0; i < ctx->num_packets; i++) {
+		for (done = 0; done < datasize; done += ret) {
+			ret = splice(ctx->in_fds[0], NULL, null, NULL,
+				     datasize - done, SPLICE_F_MOVE);
+			if (ret == 0 && !done)
+				goto out;
+			if (ret <= 0)
+				barf("SERVER: splice");
+		}
+		recv_count(rs, 1, datasize);
+	}
+out:
+	close(null);
 }
 
-static void reset_worker_signals(void)
+static void receive_eventfd(struct receiver_context *ctx, struct recv_stats *rs)
 {
-	signal(SIGTERM, SIG_DFL);
-	signal(SIGINT, SIG_DFL);
+	uint64_t i, count;
+
+	for (i = 0; i < ctx->num_packets; i += count) {
+		if (read(ctx->in_fds[0], &count, sizeof(count)) != sizeof(count))
+			barf("SERVER: eventfd read");
+		if (count >= EVENTFD_EOF) {
+			recv_count(rs, count - EVENTFD_EOF, 0);
+			return;
+		}
+		recv_count(rs, count, 0);
+	}
 }
 
-/* Sender sprays loops messages down each file descriptor */
-static void *sender(struct sender_context *ctx)
+static void receive_uring(struct receiver_context *ctx, struct recv_stats *rs)
 {
-	char data[datasize];
-	unsigned int i, j;
+	struct io_uring_cqe *cqe;
+	uint64_t i, k, n;
+	struct uring r;
+	int eof = 0;
+	char *bufs, *buf;
+
+	uring_init(&r, batch);
+	bufs = msg_buffers(batch);
+
+	for (i = 0; i < ctx->num_packets && !eof; i += n) {
+		n = ctx->num_packets - i < batch ? ctx->num_packets - i : batch;
+		for (k = 0; k < n; k++)
+			uring_queue(&r, IORING_OP_RECV, ctx->in_fds[0],
+				    bufs + k * msg_max, msg_max, k);
+		uring_submit_wait(&r);
+		while ((cqe = uring_reap(&r))) {
+			buf = bufs + cqe->user_data * msg_max;
+			if (cqe->res == 0) {
+				eof = 1;
+				continue;
+			}
+			if (cqe->res < 0 ||
+			    (framed && cqe->res < (int)sizeof(struct msg_hdr)) ||
+			    cqe->res != (int)msg_len(buf)) {
+				errno = cqe->res < 0 ? -cqe->res : EMSGSIZE;
+				barf("SERVER: io_uring recv");
+			}
+			recv_sample(rs, buf, cqe->res);
+		}
+	}
+	free(bufs);
+	close(r.fd);
+}
 
-	reset_worker_signals();
-	ready(ctx->ready_out, ctx->wakefd);
-	memset(&data, '-', datasize);
+/* Answer requests on all connections until each one was closed */
+static void receive_pingpong(struct receiver_context *ctx, struct recv_stats *rs)
+{
+	uint64_t seed = worker_seed(ctx->group, ctx->nr);
+	unsigned int k, len, open = ctx->num_conns;
+	struct pollfd *pfds;
+	struct msg_hdr hdr;
+	char *data;
+
+	pfds = calloc(ctx->num_conns, sizeof(*pfds));
+	if (!pfds)
+		barf("SERVER: malloc");
+	data = msg_buffers(1);
+	for (k = 0; k < ctx->num_conns; k++) {
+		pfds[k].fd = ctx->conns[k];
+		pfds[k].events = POLLIN;
+	}
 
-	/* Now pump to every receiver. */
-	for (i = 0; i < loops; i++) {
-		for (j = 0; j < ctx->num_fds; j++) {
-			int ret;
-			size_t done = 0;
+	while (open) {
+		if (poll(pfds, ctx->num_conns, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			barf("SERVER: poll");
+		}
+		for (k = 0; k < ctx->num_conns; k++) {
+			if (pfds[k].fd < 0 || !pfds[k].revents)
+				continue;
+
+			len = read_msg(pfds[k].fd, data);
+			memcpy(&hdr, data, sizeof(hdr));
+			if (!len || hdr.flags & MSG_BYE) {
+				pfds[k].fd = -1;
+				open--;
+				continue;
+			}
+			recv_count(rs, 1, len);
 
-again:
-			ret = write(ctx->out_fds[j], data + done, sizeof(data)-done);
-			if (ret < 0)
-				barf("SENDER: write");
-			done += ret;
-			if (done < sizeof(data))
-				goto again;
+			/* the response keeps the send time of the request */
+			hdr.len = msg_size(&seed);
+			memcpy(data, &hdr, sizeof(hdr));
+			write_full(pfds[k].fd, data, hdr.len);
 		}
 	}
-
-	return NULL;
+	free(data);
+	free(pfds);
 }
 
-
 /* One receiver per fd */
 static void *receiver(struct receiver_context* ctx)
 {
-	unsigned int i;
+	struct recv_stats rs;
 
 	reset_worker_signals();
-	if (process_mode == PROCESS_MODE)
+	if (process_mode == PROCESS_MODE && !pingpong)
 		close(ctx->in_fds[1]);
 
+	/* the round trips are measured by the senders */
+	recv_stats_init(&rs, ctx->received);
+
 	/* Wait for start... */
-	ready(ctx->ready_out, ctx->wakefd);
+	ready();
 
 	/* Receive them all */
-	for (i = 0; i < ctx->num_packets; i++) {
-		char data[datasize];
-		int ret;
-		size_t done = 0;
-
-again:
-		ret = read(ctx->in_fds[0], data + done, datasize - done);
-		if (ret < 0)
-			barf("SERVER: read");
-		done += ret;
-		if (done < datasize)
-			goto again;
+	if (pingpong)
+		receive_pingpong(ctx, &rs);
+	else switch (transport) {
+	case TRANSPORT_MMSG:
+		receive_mmsg(ctx, &rs);
+		break;
+	case TRANSPORT_SPLICE:
+		receive_splice(ctx, &rs);
+		break;
+	case TRANSPORT_EVENTFD:
+		receive_eventfd(ctx, &rs);
+		break;
+	case TRANSPORT_URING:
+		receive_uring(ctx, &rs);
+		break;
+	default:
+		receive_stream(ctx, &rs);
+		break;
 	}
+
+	if (!pingpong)
+		recv_stats_done(&rs, ctx->group);
+	else if (latency_us)
+		hist_destroy(&rs.hist);
+	usage_thread(worker_usage(ctx->group, ctx->nr, 0));
 	if (ctx) {
 		free(ctx);
 	}
 	return NULL;
 }
 
-static int create_worker(childinfo_t *child, void *ctx, void *(*func)(void *))
+/* The allowed CPUs and the nodes they are on, for the --placement policies */
+static void placement_init(void)
+{
+	struct bitmask *node_cpus;
+	int cpu, node, i;
+
+	if (!affinity_mask && numa_node < 0 && placement == PLACE_FLOAT)
+		return;
+
+	if (!affinity_mask) {
+		affinity_mask = numa_allocate_cpumask();
+		if (!affinity_mask || numa_sched_getaffinity(0, affinity_mask) < 0)
+			barf("numa_sched_getaffinity");
+	}
+
+	if (numa_node >= 0) {
+		node_cpus = numa_allocate_cpumask();
+		if (!node_cpus || numa_node_to_cpus(numa_node, node_cpus) < 0)
+			barf("numa_node_to_cpus");
+		for (cpu = 0; cpu < max_cpus; cpu++)
+			if (!numa_bitmask_isbitset(node_cpus, cpu))
+				numa_bitmask_clearbit(affinity_mask, cpu);
+		numa_bitmask_free(node_cpus);
+	}
+
+	if (!get_available_cpus(affinity_mask)) {
+		fprintf(stderr, "No CPUs left to run the workers on\n");
+		exit(1);
+	}
+
+	for (cpu = 0; cpu < max_cpus; cpu++) {
+		if (!numa_bitmask_isbitset(affinity_mask, cpu))
+			continue;
+		node = numa_node_of_cpu(cpu);
+		for (i = 0; i < nr_place_nodes; i++)
+			if (place_nodes[i] == node)
+				break;
+		if (i == nr_place_nodes)
+			place_nodes[nr_place_nodes++] = node;
+	}
+
+	if (placement == PLACE_SPLIT && nr_place_nodes < 2) {
+		fprintf(stderr, "The split placement needs CPUs on two NUMA nodes\n");
+		exit(1);
+	}
+}
+
+static void node_cpuset(int node, cpu_set_t *cpus)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < max_cpus; cpu++)
+		if (numa_bitmask_isbitset(affinity_mask, cpu) &&
+		    numa_node_of_cpu(cpu) == node)
+			CPU_SET(cpu, cpus);
+}
+
+/*
+ * The CPUs worker nr (sender or receiver) of group may run on. Returns 0
+ * if it may run anywhere.
+ */
+static int worker_cpus(unsigned int group, unsigned int nr, int is_sender,
+		       cpu_set_t *cpus)
+{
+	if (!affinity_mask)
+		return 0;
+
+	CPU_ZERO(cpus);
+	switch (placement) {
+	case PLACE_SPREAD:
+		node_cpuset(place_nodes[group % nr_place_nodes], cpus);
+		break;
+	case PLACE_PAIR:
+		CPU_SET(cpu_for_thread_sp(group * num_fds + nr, max_cpus,
+					  affinity_mask), cpus);
+		break;
+	case PLACE_SPLIT:
+		node_cpuset(place_nodes[(group + is_sender) % nr_place_nodes],
+			    cpus);
+		break;
+	default:
+		cpumask_to_cpuset(affinity_mask, cpus);
+		break;
+	}
+	return 1;
+}
+
+static void print_placement(void)
+{
+	cpu_set_t cpus;
+	char buf[1024];
+	int i;
+
+	if (!affinity_mask)
+		return;
+
+	cpumask_to_cpuset(affinity_mask, &cpus);
+	format_cpulist(&cpus, buf, sizeof(buf));
+	printf("Placing the workers on CPUs %s", buf);
+	if (placement == PLACE_SPREAD || placement == PLACE_SPLIT) {
+		printf(", %s over nodes", placement_names[placement]);
+		for (i = 0; i < nr_place_nodes; i++)
+			printf("%s%d", i ? "," : " ", place_nodes[i]);
+	} else if (placement == PLACE_PAIR) {
+		printf(", a CPU per sender and receiver pair");
+	}
+	printf("\n");
+}
+
+static int create_worker(childinfo_t *child, void *ctx, void *(*func)(void *),
+			 cpu_set_t *cpus)
 {
 	pthread_attr_t attr;
+	pid_t pid;
 	int err;
 
 	switch (process_mode) {
 	case PROCESS_MODE: /* process mode */
-		/* Fork the sender/receiver child. */
-		switch ((child->pid = fork())) {
+		/* Fork the sender/receiver child. child_tab is shared, only the
+		 * parent may store the pid. */
+		switch ((pid = fork())) {
 			case -1:
 				sneeze("fork()");
 				return -1;
+			default:
+				child->pid = pid;
+				break;
 			case 0:
+				if (cpus && sched_setaffinity(0, sizeof(*cpus), cpus))
+					barf("sched_setaffinity()");
 				(*func) (ctx);
 				exit(0);
 		}
@@ -280,6 +1721,11 @@ static int create_worker(childinfo_t *child, void *ctx, void *(*func)(void *))
 		}
 #endif
 
+		if (cpus && pthread_attr_setaffinity_np(&attr, sizeof(*cpus), cpus) != 0) {
+			sneeze("pthread_attr_setaffinity_np()");
+			return -1;
+		}
+
 		if ((err=pthread_create(&child->threadid, &attr, func, ctx)) != 0) {
 			sneeze("pthread_create failed()");
 			return -1;
@@ -291,10 +1737,19 @@ static int create_worker(childinfo_t *child, void *ctx, void *(*func)(void *))
 
 void signal_workers(childinfo_t *children, unsigned int num_children)
 {
-	unsigned int i;
-	printf("signaling %d worker threads to terminate\n", num_children);
-	for (i=0; i < num_children; i++) {
-		kill(children[i].pid, SIGTERM);
+	unsigned int i, n = 0;
+
+	/* threads end with the process, kill() only takes pids */
+	if (process_mode == THREAD_MODE)
+		return;
+
+	/* slots of workers which were never forked are still 0 */
+	for (i = 0; i < num_children; i++)
+		n += children[i].pid > 0;
+	printf("signaling %d worker processes to terminate\n", n);
+	for (i = 0; i < num_children; i++) {
+		if (children[i].pid > 0)
+			kill(children[i].pid, SIGTERM);
 	}
 }
 
@@ -308,6 +1763,9 @@ unsigned int reap_workers(childinfo_t *child, unsigned int totchld, unsigned int
 		fprintf(stderr, "sending SIGTERM to all child processes\n");
 		signal(SIGTERM, SIG_IGN);
 		signal_workers(child, totchld);
+		/* the threads can't be stopped, they go down with exit() */
+		if (process_mode == THREAD_MODE)
+			return totchld;
 	}
 
 	for( i = 0; i < totchld; i++ ) {
@@ -315,10 +1773,10 @@ unsigned int reap_workers(childinfo_t *child, unsigned int totchld, unsigned int
 		switch( process_mode ) {
 		case PROCESS_MODE: /* process mode */
 			fflush(stdout);
-			pid = wait(&status);
+			pid = usage_stats ? wait_usage(&status) : wait(&status);
 			if (pid == -1 && errno == ECHILD)
 				break;
-			if (!WIFEXITED(status))
+			if (!WIFEXITED(status) || WEXITSTATUS(status))
 				rc++;
 			break;
 		case THREAD_MODE: /* threaded mode */
@@ -333,28 +1791,44 @@ unsigned int reap_workers(childinfo_t *child, unsigned int totchld, unsigned int
 	return rc;
 }
 
-/* One group of senders and receivers */
+/*
+ * One group of senders and receivers. Sender N writes to receivers N to
+ * N + fanout - 1; with --pingpong each of these pairs gets a connection
+ * of its own, so the response goes back to the right sender.
+ */
 static unsigned int group(childinfo_t *child,
+			  unsigned int group_nr,
 			  unsigned int tab_offset,
-			  unsigned int num_fds,
-			  int ready_out,
-			  int wakefd)
+			  unsigned int num_fds)
 {
-	unsigned int i;
-	struct sender_context* snd_ctx = malloc (sizeof(struct sender_context)
-			+num_fds*sizeof(int));
-	int err;
-
-	if (!snd_ctx) {
+	unsigned int i, j, nconns = pingpong ? num_fds * fanout : 0;
+	struct sender_context *snd_ctx;
+	int *group_fds, *conns = NULL;
+	cpu_set_t cpus;
+	int err, pin;
+
+	group_fds = malloc(num_fds * sizeof(int));
+	if (!group_fds) {
 		sneeze("malloc() [sender ctx]");
 		return 0;
 	}
 
+	if (pingpong) {
+		/* conns[2 * (sender * fanout + j)] is the receiver's end */
+		conns = malloc(nconns * 2 * sizeof(int));
+		if (!conns) {
+			sneeze("malloc() [connections]");
+			return 0;
+		}
+		for (i = 0; i < nconns; i++)
+			fdpair(&conns[2 * i]);
+	}
 
 	for (i = 0; i < num_fds; i++) {
-		int fds[2];
-		struct receiver_context* ctx = malloc (sizeof(*ctx));
+		int fds[2] = { -1, -1 };
+		struct receiver_context* ctx;
 
+		ctx = malloc(sizeof(*ctx) + (pingpong ? fanout : 0) * sizeof(int));
 		if (!ctx) {
 			sneeze("malloc() [receiver ctx]");
 			return (i > 0 ? i-1 : 0);
@@ -362,69 +1836,227 @@ static unsigned int group(childinfo_t *child,
 
 
 		/* Create the pipe between client and server */
-		fdpair(fds);
+		if (!pingpong)
+			fdpair(fds);
 
-		ctx->num_packets = num_fds*loops;
+		ctx->num_packets = duration ? UINT64_MAX : (uint64_t)fanout*loops;
+		ctx->group = group_nr;
+		ctx->nr = i;
+		ctx->received = &received[(group_nr * num_fds + i) * RECV_SLOT];
 		ctx->in_fds[0] = fds[0];
 		ctx->in_fds[1] = fds[1];
-		ctx->ready_out = ready_out;
-		ctx->wakefd = wakefd;
+		ctx->num_conns = pingpong ? fanout : 0;
+		for (j = 0; j < ctx->num_conns; j++)
+			ctx->conns[j] = conns[2 * (((i + num_fds - j) % num_fds) *
+						   fanout + j)];
 
+		pin = worker_cpus(group_nr, i, 0, &cpus);
 		err = create_worker(&child[tab_offset+i], ctx,
-				    (void *)(void *)receiver);
+				    (void *)(void *)receiver, pin ? &cpus : NULL);
 		if(err) {
 			return (i > 0 ? i-1 : 0);
 		}
-		snd_ctx->out_fds[i] = fds[1];
-		if (process_mode == PROCESS_MODE)
-			close(fds[0]);
+		group_fds[i] = fds[1];
+		if (process_mode == PROCESS_MODE) {
+			if (!pingpong)
+				close(fds[0]);
+			free(ctx);
+		}
 	}
 
-	snd_ctx->ready_out = ready_out;
-	snd_ctx->wakefd = wakefd;
-	snd_ctx->num_fds = num_fds;
-
 	/* Now we have all the fds, fork the senders */
 	for (i = 0; i < num_fds; i++) {
+		snd_ctx = malloc(sizeof(*snd_ctx) + fanout * sizeof(int));
+		if (!snd_ctx) {
+			sneeze("malloc() [sender ctx]");
+			return (num_fds+i)-1;
+		}
+		snd_ctx->num_fds = fanout;
+		snd_ctx->group = group_nr;
+		snd_ctx->nr = i;
+		snd_ctx->group_fds = group_fds;
+		for (j = 0; j < fanout; j++)
+			snd_ctx->out_fds[j] = pingpong ?
+				conns[2 * (i * fanout + j) + 1] :
+				group_fds[(i + j) % num_fds];
+
+		pin = worker_cpus(group_nr, i, 1, &cpus);
 		err = create_worker(&child[tab_offset+num_fds+i], snd_ctx,
-				    (void *)(void *)sender);
+				    (void *)(void *)sender, pin ? &cpus : NULL);
 		if(err) {
 			return (num_fds+i)-1;
 		}
+		if (process_mode == PROCESS_MODE)
+			free(snd_ctx);
 	}
 
 	/* Close the fds we have left */
-	if (process_mode == PROCESS_MODE)
-		for (i = 0; i < num_fds; i++)
-			close(snd_ctx->out_fds[i]);
+	if (process_mode == PROCESS_MODE) {
+		for (i = 0; i < num_fds && !pingpong; i++)
+			close(group_fds[i]);
+		for (i = 0; i < nconns * 2; i++)
+			close(conns[i]);
+	}
 
 	/* Return number of children to reap */
 	return num_fds * 2;
 }
 
+/* Read the sizes of --sizes=file:PATH, separated by white space */
+static int read_size_table(const char *path)
+{
+	unsigned int size, len = 0, alloc = 0, *table = NULL;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -errno;
+	while (fscanf(f, "%u", &size) == 1) {
+		if (len == alloc) {
+			alloc = alloc ? alloc * 2 : 256;
+			table = realloc(table, alloc * sizeof(*table));
+			if (!table) {
+				fclose(f);
+				return -ENOMEM;
+			}
+		}
+		table[len++] = size;
+	}
+	if (!feof(f) || !len) {
+		free(table);
+		fclose(f);
+		return -EINVAL;
+	}
+	fclose(f);
+
+	size_table = table;
+	size_table_len = len;
+	return 0;
+}
+
+/* fixed, uniform:MIN-MAX, bimodal:SMALL,LARGE,PCT or file:PATH */
+static int parse_size_dist(const char *arg)
+{
+	char end;
+	int ret;
+
+	if (!strcmp(arg, "fixed")) {
+		size_dist = SIZE_FIXED;
+	} else if (sscanf(arg, "uniform:%u-%u%c", &size_min, &size_max, &end) == 2) {
+		if (size_min > size_max)
+			return -EINVAL;
+		size_dist = SIZE_UNIFORM;
+	} else if (sscanf(arg, "bimodal:%u,%u,%u%c", &size_min, &size_max,
+			  &size_pct, &end) == 3) {
+		if (size_pct > 100)
+			return -EINVAL;
+		size_dist = SIZE_BIMODAL;
+	} else if (!strncmp(arg, "file:", 5)) {
+		ret = read_size_table(arg + 5);
+		if (ret)
+			return ret;
+		size_dist = SIZE_FILE;
+	} else {
+		return -EINVAL;
+	}
+	size_arg = arg;
+	return 0;
+}
+
+/* The smallest and largest message of the --sizes distribution */
+static void size_range(unsigned int *min, unsigned int *max)
+{
+	unsigned int i;
+
+	switch (size_dist) {
+	case SIZE_UNIFORM:
+		*min = size_min;
+		*max = size_max;
+		break;
+	case SIZE_BIMODAL:
+		*min = size_min < size_max ? size_min : size_max;
+		*max = size_min < size_max ? size_max : size_min;
+		break;
+	case SIZE_FILE:
+		*min = *max = size_table[0];
+		for (i = 1; i < size_table_len; i++) {
+			if (size_table[i] < *min)
+				*min = size_table[i];
+			if (size_table[i] > *max)
+				*max = size_table[i];
+		}
+		break;
+	default:
+		*min = *max = datasize;
+		break;
+	}
+}
+
 static void process_options(int argc, char *argv[])
 {
+	unsigned int min_size;
+	int i;
+
+	max_cpus = sysconf(_SC_NPROCESSORS_CONF);
+
 	for(;;) {
 		static struct option longopts[] = {
+			{"affinity",	required_argument,	NULL, 'a'},
+			{"batch",	required_argument,	NULL, 'b'},
+			{"duration",	required_argument,	NULL, 'D'},
 			{"fds",		required_argument,	NULL, 'f'},
 			{"fifo",	no_argument,		NULL, 'F'},
 			{"groups",	required_argument,	NULL, 'g'},
 			{"help",	no_argument,		NULL, 'h'},
 			{"loops",	required_argument,	NULL, 'l'},
+			{"latency",	required_argument,	NULL, 'L'},
+			{"placement",	required_argument,	NULL, 'm'},
+			{"node",	required_argument,	NULL, 'N'},
+			{"fanout",	required_argument,	NULL, 'o'},
 			{"pipe",	no_argument,		NULL, 'p'},
+			{"rate",	required_argument,	NULL, 'r'},
+			{"pingpong",	no_argument,		NULL, 'R'},
 			{"inet",	no_argument,		NULL, 'i'},
 			{"datasize",	required_argument,	NULL, 's'},
+			{"sizes",	required_argument,	NULL, 'S'},
+			{"transport",	required_argument,	NULL, 't'},
 			{"threads",	no_argument,		NULL, 'T'},
+			{"usage",	no_argument,		NULL, 'u'},
 			{"processes",	no_argument,		NULL, 'P'},
 			{NULL, 0, NULL, 0}
 		};
 
-		int c = getopt_long(argc, argv, "f:Fg:hl:pis:TP",
+		int c = getopt_long(argc, argv, "a:b:D:f:Fg:hl:L:m:N:o:pr:Ris:S:t:TuP",
 				    longopts, NULL);
 		if (c == -1) {
 			break;
 		}
 		switch (c) {
+		case 'a':
+			if (!numa_initialize()) {
+				fprintf(stderr, "%s: --affinity|-a needs libnuma\n", argv[0]);
+				print_usage_exit(1);
+			}
+			if (parse_cpumask(optarg, max_cpus, &affinity_mask) || !affinity_mask) {
+				fprintf(stderr, "%s: invalid CPU set '%s'\n", argv[0], optarg);
+				print_usage_exit(1);
+			}
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			if (atoi(optarg) <= 0 || batch > UIO_MAXIOV) {
+				fprintf(stderr, "%s: --batch|-b requires an integer between 1 and %d\n",
+					argv[0], UIO_MAXIOV);
+				print_usage_exit(1);
+			}
+			break;
+		case 'D':
+			duration = parse_time_string(optarg);
+			if (duration <= 0) {
+				fprintf(stderr, "%s: --duration|-D requires a time > 0\n", argv[0]);
+				print_usage_exit(1);
+			}
+			break;
 		case 'f':
 			num_fds = atoi(optarg);
 			if (atoi(optarg) <= 0) {
@@ -452,9 +2084,56 @@ static void process_options(int argc, char *argv[])
 				print_usage_exit(1);
 			}
 			break;
+		case 'L':
+			latency_us = atoi(optarg);
+			if (atoi(optarg) <= 0) {
+				fprintf(stderr, "%s: --latency|-L requires an integer > 0\n", argv[0]);
+				print_usage_exit(1);
+			}
+			break;
+		case 'm':
+			for (i = 0; i < NR_PLACEMENTS; i++)
+				if (!strcmp(optarg, placement_names[i]))
+					break;
+			if (i == NR_PLACEMENTS) {
+				fprintf(stderr, "%s: unknown placement '%s'\n", argv[0], optarg);
+				print_usage_exit(1);
+			}
+			placement = i;
+			break;
+		case 'N':
+			if (!numa_initialize()) {
+				fprintf(stderr, "%s: --node|-N needs libnuma\n", argv[0]);
+				print_usage_exit(1);
+			}
+			numa_node = atoi(optarg);
+			if (numa_node < 0 || numa_node > numa_max_node()) {
+				fprintf(stderr, "%s: --node|-N requires a node between 0 and %d\n",
+					argv[0], numa_max_node());
+				print_usage_exit(1);
+			}
+			break;
+		case 'o':
+			fanout = atoi(optarg);
+			if (atoi(optarg) <= 0) {
+				fprintf(stderr, "%s: --fanout|-o requires an integer > 0\n", argv[0]);
+				print_usage_exit(1);
+			}
+			break;
 		case 'p':
 			use_pipes = 1;
 			break;
+		case 'r':
+			rate = atoi(optarg);
+			if (atoi(optarg) <= 0 || rate > NSEC_PER_SEC) {
+				fprintf(stderr, "%s: --rate|-r requires an integer between 1 and %d\n",
+					argv[0], NSEC_PER_SEC);
+				print_usage_exit(1);
+			}
+			break;
+		case 'R':
+			pingpong = 1;
+			break;
 		case 'i':
 			use_inet = 1;
 			break;
@@ -465,9 +2144,28 @@ static void process_options(int argc, char *argv[])
 				print_usage_exit(1);
 			}
 			break;
+		case 'S':
+			if (parse_size_dist(optarg)) {
+				fprintf(stderr, "%s: invalid size distribution '%s'\n", argv[0], optarg);
+				print_usage_exit(1);
+			}
+			break;
+		case 't':
+			for (i = 0; i < NR_TRANSPORTS; i++)
+				if (!strcmp(optarg, transport_names[i]))
+					break;
+			if (i == NR_TRANSPORTS) {
+				fprintf(stderr, "%s: unknown transport '%s'\n", argv[0], optarg);
+				print_usage_exit(1);
+			}
+			transport = i;
+			break;
 		case 'T':
 			process_mode = THREAD_MODE;
 			break;
+		case 'u':
+			usage_stats = 1;
+			break;
 		case 'P':
 			process_mode = PROCESS_MODE;
 			break;
@@ -476,10 +2174,153 @@ static void process_options(int argc, char *argv[])
 		}
 	}
 
+	framed = size_dist != SIZE_FIXED || pingpong;
+	size_range(&min_size, &msg_max);
+	if (framed && min_size < sizeof(struct msg_hdr)) {
+		fprintf(stderr, "%s: --sizes|-S and --pingpong|-R need messages of at least %zu bytes\n",
+			argv[0], sizeof(struct msg_hdr));
+		print_usage_exit(1);
+	}
+	if (latency_us && min_size < sizeof(uint64_t)) {
+		fprintf(stderr, "%s: --latency|-L needs a --datasize|-s of at least %zu\n",
+			argv[0], sizeof(uint64_t));
+		print_usage_exit(1);
+	}
+
+	if (!fanout)
+		fanout = num_fds;
+	if (fanout > num_fds) {
+		fprintf(stderr, "%s: --fanout|-o can't be larger than --fds|-f\n", argv[0]);
+		print_usage_exit(1);
+	}
+
 	if (use_pipes && use_inet) {
 		fprintf(stderr, "%s: --pipe|-p and --inet|-i cannot be used together\n", argv[0]);
 		print_usage_exit(1);
 	}
+
+	if ((use_pipes || use_inet) && transport != TRANSPORT_SOCKET) {
+		fprintf(stderr, "%s: --pipe|-p and --inet|-i cannot be used with --transport|-t\n", argv[0]);
+		print_usage_exit(1);
+	}
+	if (use_pipes)
+		transport = TRANSPORT_PIPE;
+	if (use_inet)
+		transport = TRANSPORT_INET;
+
+	/*
+	 * With a fanout the senders share the receivers' pipes and inet
+	 * connections, so framed messages must not be split up by other
+	 * senders. Pipes only write up to PIPE_BUF bytes in one piece and
+	 * TCP not even that. The socket transport uses packets instead.
+	 */
+	if (framed && !pingpong && fanout > 1) {
+		if (transport == TRANSPORT_PIPE && msg_max > PIPE_BUF) {
+			fprintf(stderr, "%s: --sizes|-S over pipes is limited to %d bytes unless --fanout|-o is 1\n",
+				argv[0], PIPE_BUF);
+			print_usage_exit(1);
+		}
+		if (transport == TRANSPORT_INET) {
+			fprintf(stderr, "%s: --sizes|-S over inet needs --fanout|-o 1 or --pingpong|-R\n",
+				argv[0]);
+			print_usage_exit(1);
+		}
+	}
+
+	if (transport == TRANSPORT_SPLICE && msg_max > sysconf(_SC_PAGESIZE)) {
+		fprintf(stderr, "%s: messages of the splice transport are limited to %ld bytes\n",
+			argv[0], sysconf(_SC_PAGESIZE));
+		print_usage_exit(1);
+	}
+
+	if (placement != PLACE_FLOAT && !numa_initialize()) {
+		fprintf(stderr, "%s: --placement|-m needs libnuma\n", argv[0]);
+		print_usage_exit(1);
+	}
+	placement_init();
+
+	if ((latency_us || framed) && transport == TRANSPORT_EVENTFD) {
+		fprintf(stderr, "%s: --latency|-L, --sizes|-S and --pingpong|-R need a transport with data\n",
+			argv[0]);
+		print_usage_exit(1);
+	}
+
+	if (pingpong && transport != TRANSPORT_SOCKET && transport != TRANSPORT_INET) {
+		fprintf(stderr, "%s: --pingpong|-R needs the socket or inet transport\n", argv[0]);
+		print_usage_exit(1);
+	}
+}
+
+struct group_creator {
+	pthread_t thread;
+	unsigned int group;
+	unsigned int started;
+};
+
+static void *group_creator(void *arg)
+{
+	struct group_creator *gc = arg;
+
+	gc->started = group(child_tab, gc->group, gc->group * num_fds * 2,
+			    num_fds);
+	return NULL;
+}
+
+/*
+ * Create the groups in parallel. In process mode a leader process per
+ * group creates it and exits, so the groups don't inherit each others'
+ * fds; the workers are adopted by main as the child subreaper. The
+ * worker pids come back through the shared child_tab.
+ */
+static int create_groups(void)
+{
+	struct group_creator *gc;
+	unsigned int i, failed = 0;
+	int status;
+	pid_t *leaders;
+
+	if (process_mode == PROCESS_MODE) {
+		if (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0)
+			barf("PR_SET_CHILD_SUBREAPER");
+		leaders = calloc(num_groups, sizeof(*leaders));
+		if (!leaders)
+			barf("main:malloc()");
+
+		for (i = 0; i < num_groups; i++) {
+			leaders[i] = fork();
+			if (leaders[i] < 0) {
+				sneeze("fork()");
+				failed++;
+				break;
+			}
+			if (leaders[i] == 0)
+				_exit(group(child_tab, i, i * num_fds * 2,
+					    num_fds) != num_fds * 2);
+		}
+		for (i = 0; i < num_groups && leaders[i] > 0; i++) {
+			if (waitpid(leaders[i], &status, 0) < 0 ||
+			    !WIFEXITED(status) || WEXITSTATUS(status))
+				failed++;
+		}
+		free(leaders);
+		return failed;
+	}
+
+	gc = calloc(num_groups, sizeof(*gc));
+	if (!gc)
+		barf("main:malloc()");
+	for (i = 0; i < num_groups; i++) {
+		gc[i].group = i;
+		if (pthread_create(&gc[i].thread, NULL, group_creator, &gc[i]))
+			barf("pthread_create failed()");
+	}
+	for (i = 0; i < num_groups; i++) {
+		pthread_join(gc[i].thread, NULL);
+		if (gc[i].started != num_fds * 2)
+			failed++;
+	}
+	free(gc);
+	return failed;
 }
 
 void sigcatcher(int sig) {
@@ -492,27 +2333,64 @@ void sigcatcher(int sig) {
 
 int main(int argc, char *argv[])
 {
-	unsigned int i;
-	struct timeval start, stop, diff;
-	int readyfds[2], wakefds[2];
-	char dummy;
+	struct timeval setup, start, stop, diff;
 	volatile int timer_started = 0;
+	unsigned int failed;
+	unsigned int min_size, max_size;
 	struct sched_param sp;
+	struct rlimit rl;
+	char sizes[32];
+	uint32_t n;
 
 	process_options (argc, argv);
 
+	size_range(&min_size, &max_size);
+	if (min_size == max_size)
+		snprintf(sizes, sizeof(sizes), "%u", min_size);
+	else
+		snprintf(sizes, sizeof(sizes), "%u-%u", min_size, max_size);
+
 	printf("Running in %s mode with %d groups using %d file descriptors each (== %d tasks)\n",
 	       (process_mode == THREAD_MODE ? "threaded" : "process"),
 	       num_groups, 2*num_fds, num_groups*(num_fds*2));
-	printf("Each sender will pass %d messages of %d bytes\n", loops, datasize);
+	if (duration && transport == TRANSPORT_EVENTFD)
+		printf("Each sender will pass eventfd signals for %d seconds\n", duration);
+	else if (duration)
+		printf("Each sender will pass messages of %s bytes for %d seconds\n",
+		       sizes, duration);
+	else if (transport == TRANSPORT_EVENTFD)
+		printf("Each sender will pass %d eventfd signals\n", loops);
+	else
+		printf("Each sender will pass %d messages of %s bytes\n", loops, sizes);
+	if (size_dist != SIZE_FIXED)
+		printf("Message sizes are drawn from %s\n", size_arg);
+	if (fanout < num_fds)
+		printf("Each sender sends to %u of the receivers\n", fanout);
+	if (pingpong)
+		printf("Each message is answered before the sender sends the next one\n");
+	if (rate)
+		printf("Each sender is limited to %u messages per second\n", rate);
+	print_placement();
+	if (transport == TRANSPORT_MMSG || transport == TRANSPORT_URING)
+		printf("Using %s with %d messages per system call\n",
+		       transport_names[transport], batch);
+	else if (transport == TRANSPORT_SPLICE)
+		printf("Using vmsplice\n");
 	fflush(NULL);
 
-	child_tab = calloc(num_fds * 2 * num_groups, sizeof(childinfo_t));
-	if (!child_tab)
-		barf("main:malloc()");
+	total_workers = num_fds * 2 * num_groups;
+	child_tab = mmap(NULL, total_workers * sizeof(childinfo_t),
+			 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (child_tab == MAP_FAILED)
+		barf("main:mmap()");
 
-	fdpair(readyfds);
-	fdpair(wakefds);
+	stats_init();
+
+	/* --pingpong needs a connection per sender and receiver pair */
+	if (pingpong && !getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
 
 	/* Catch some signals */
 	signal(SIGINT, sigcatcher);
@@ -520,16 +2398,13 @@ int main(int argc, char *argv[])
 	signal(SIGHUP, SIG_IGN);
 
 	if (setjmp(jmpbuf) == 0) {
-		total_children = 0;
-		for (i = 0; i < num_groups; i++) {
-			unsigned int c = group(child_tab, total_children, num_fds, readyfds[1], wakefds[0]);
-			if( c != (num_fds*2) ) {
-				fprintf(stderr, "%i children started.  Expected %i\n", c, num_fds*2);
-				reap_workers(child_tab, total_children + c, 1);
-				barf("Creating workers");
-			}
-			total_children += c;
+		gettimeofday(&setup, NULL);
+		if (create_groups()) {
+			fprintf(stderr, "Not all groups started\n");
+			signal_workers(child_tab, total_workers);
+			barf("Creating workers");
 		}
+		total_children = total_workers;
 		if (fifo) {
 			/* make main a realtime task so that we can manage the workers */
 			sp.sched_priority = 1;
@@ -538,20 +2413,19 @@ int main(int argc, char *argv[])
 		}
 
 		/* Wait for everyone to be ready */
-		for (i = 0; i < total_children; i++)
-			if (read(readyfds[0], &dummy, 1) != 1) {
-				reap_workers(child_tab, total_children, 1);
-				barf("Reading for readyfds");
-			}
+		while ((n = __atomic_load_n(&ctl->ready, __ATOMIC_ACQUIRE)) < total_children)
+			futex_wait(&ctl->ready, n);
 
 		gettimeofday(&start, NULL);
 		timer_started = 1;
+		ctl->start = now_ns();
 
 		/* Kick them off */
-		if (write(wakefds[1], &dummy, 1) != 1) {
-			reap_workers(child_tab, total_children, 1);
-			barf("Writing to start senders");
-		}
+		__atomic_store_n(&ctl->go, 1, __ATOMIC_RELEASE);
+		futex_wake(&ctl->go, INT_MAX);
+
+		if (duration)
+			report_loop();
 	}
 	else {
 		fprintf(stderr, "longjmp'ed out, reaping children\n");
@@ -560,17 +2434,30 @@ int main(int argc, char *argv[])
 	}
 
 	/* Reap them all */
-	reap_workers(child_tab, total_children, signal_caught);
+	failed = reap_workers(child_tab, total_children, signal_caught);
+	if (failed && !signal_caught) {
+		fprintf(stderr, "%u workers failed\n", failed);
+		timer_started = 0;
+	}
 
 	gettimeofday(&stop, NULL);
 
 	/* Print time... */
 	if (timer_started) {
+		timersub(&start, &setup, &diff);
+		printf("Setup: %lu.%03lu\n", diff.tv_sec, diff.tv_usec/1000);
 		timersub(&stop, &start, &diff);
 		printf("Time: %lu.%03lu\n", diff.tv_sec, diff.tv_usec/1000);
+		if (duration)
+			printf("Messages: %llu\n",
+			       (unsigned long long)total_received(0));
+		if (latency_us && !signal_caught)
+			stats_print();
+		if (usage_stats && !signal_caught)
+			usage_print();
 	}
 	else
 		fprintf(stderr, "No measurements available\n");
-	free(child_tab);
-	exit(0);
+	munmap(child_tab, total_workers * sizeof(childinfo_t));
+	exit(failed && !signal_caught ? 1 : 0);
 }
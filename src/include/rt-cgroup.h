@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef __RT_CGROUP_H
+#define __RT_CGROUP_H
+
+#include <sys/types.h>
+
+enum cgroup_partition {
+	CGROUP_ISOLATED,	/* no load balancing */
+	CGROUP_ROOT,		/* load balanced, e.g. for global EDF */
+};
+
+int cgroup_isolate(const char *cpus, enum cgroup_partition type);
+int cgroup_isolate_thread(pid_t tid);
+void cgroup_restore(void);
+
+#endif	/* __RT_CGROUP_H */
@@ -0,0 +1,87 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef __RT_COUNTER_H
+#define __RT_COUNTER_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * The free running counter of the architecture, read with the ordering
+ * a measurement of the code in between needs. COUNTER_MISSING is defined
+ * where the architecture has none, counter_read() returns CLOCK_MONOTONIC
+ * in ns there.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t counter_read(void)
+{
+	uint32_t low, high;
+
+	/* See rdtsc_ordered() of Linux, lfence came with SSE2 */
+#if defined(__x86_64__) || defined(__SSE2__)
+	__asm__ __volatile__("lfence; rdtsc" : "=a" (low), "=d" (high) :: "memory");
+#else
+	__asm__ __volatile__("rdtsc" : "=a" (low), "=d" (high) :: "memory");
+#endif
+	return ((uint64_t) high << 32) | low;
+}
+#elif defined(__PPC64__)
+static inline uint64_t counter_read(void)
+{
+	uint64_t val;
+
+	__asm__ __volatile__("mfspr %0, 268\n" : "=r" (val));
+	return val;
+}
+#elif defined(__aarch64__)
+static inline uint64_t counter_read(void)
+{
+	uint64_t val;
+
+	/*
+	 * This isb() is required to prevent that the counter value
+	 * is speculated.
+	 */
+	__asm__ __volatile__("isb" : : : "memory");
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (val) :: "memory");
+	/*
+	 * This isb() is required to prevent the processor from accessing
+	 * memory appearing in program order after the read of the counter
+	 * before the counter has been read. Which would skew the counter value
+	 * to a later point than intended.
+	 */
+	__asm__ __volatile__("isb" : : : "memory");
+	return val;
+}
+#elif defined(__loongarch64)
+static inline uint64_t counter_read(void)
+{
+	uint64_t val, id;
+
+	/* Don't let the counter read pass earlier memory accesses */
+	__asm__ __volatile__("dbar 0" : : : "memory");
+	__asm__ __volatile__("rdtime.d %0, %1" : "=r" (val), "=r" (id) :: "memory");
+	return val;
+}
+#elif defined(__riscv) && __riscv_xlen == 64
+static inline uint64_t counter_read(void)
+{
+	uint64_t val;
+
+	__asm__ __volatile__("fence iorw, iorw" : : : "memory");
+	__asm__ __volatile__("rdtime %0" : "=r" (val) :: "memory");
+	return val;
+}
+#else
+#define COUNTER_MISSING
+static inline uint64_t counter_read(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+#endif
+
+uint64_t counter_hz(const char *cache);
+
+#endif	/* __RT_COUNTER_H */
@@ -0,0 +1,8 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef __RT_IRQ_H
+#define __RT_IRQ_H
+
+int irq_steer_away(const char *cpus);
+void irq_restore(void);
+
+#endif	/* __RT_IRQ_H */
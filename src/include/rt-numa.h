@@ -2,6 +2,7 @@
 #ifndef __RT_NUMA_H
 #define __RT_NUMA_H
 
+#include <sched.h>
 #include <numa.h>
 
 enum {
@@ -17,5 +18,6 @@ int cpu_for_thread_sp(int thread_num, int max_cpus, struct bitmask *cpumask);
 int cpu_for_thread_ua(int thread_num, int max_cpus);
 
 int parse_cpumask(char *str, int max_cpus, struct bitmask **cpumask);
+void cpumask_to_cpuset(struct bitmask *cpumask, cpu_set_t *set);
 
 #endif
@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+#ifndef __RT_OSNOISE_H
+#define __RT_OSNOISE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum noise_source {
+	NOISE_NMI,
+	NOISE_IRQ,
+	NOISE_SOFTIRQ,
+	NOISE_THREAD,
+	NR_NOISE_SOURCES,
+};
+
+struct noise_event {
+	uint64_t end;			/* CLOCK_MONOTONIC, ns */
+	uint64_t duration;		/* ns */
+	enum noise_source source;
+	int id;				/* irq/softirq vector or pid */
+	char desc[24];			/* irq action, softirq or comm */
+};
+
+/* Events of one CPU, ordered by end time */
+struct noise_cpu {
+	struct noise_event *events;
+	size_t nr;
+	size_t size;
+	uint64_t lost;
+};
+
+extern const char * const noise_source_names[NR_NOISE_SOURCES];
+
+int osnoise_start(const char *cpus);
+void osnoise_stop(void);
+struct noise_cpu *osnoise_cpu(int cpu);
+size_t osnoise_find(struct noise_cpu *nc, uint64_t start);
+
+#endif	/* __RT_OSNOISE_H */
@@ -2,6 +2,7 @@
 #ifndef __RT_UTILS_H
 #define __RT_UTILS_H
 
+#include <sched.h>
 #include <stdint.h>
 
 #define _STR(x) #x
@@ -29,6 +30,11 @@ pid_t gettid(void);
 
 int parse_time_string(char *val);
 int parse_mem_string(char *str, uint64_t *val);
+int parse_cpulist(const char *str, cpu_set_t *set);
+int format_cpulist(cpu_set_t *set, char *buf, size_t len);
+int housekeeping_cpus(const char *cpus, cpu_set_t *hk);
+
+int cleanup_on_signal(void (*fn)(void));
 
 void enable_trace_mark(void);
 void tracemark(char *fmt, ...) __attribute__((format(printf, 1, 2)));
@@ -85,5 +91,6 @@ void rt_init(int argc, char *argv[]);
 void rt_write_json(const char *filename, int return_code,
 		   void (*cb)(FILE *, void *),
 		   void *data);
+void rt_write_json_string(FILE *f, const char *str);
 
 #endif	/* __RT_UTILS.H */
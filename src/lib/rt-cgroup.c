@@ -0,0 +1,442 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * cgroup v2 cpuset isolation
+ *
+ * Splits the machine into two threaded cpusets below the cgroup v2 root:
+ *
+ *   rt-tests.isolated      the CPUs under test, set up as a partition
+ *                          (isolated or load balanced, no other tasks)
+ *   rt-tests.housekeeping  all remaining online CPUs
+ *
+ * The calling process and every task which can be moved out of the root
+ * cgroup are put into the housekeeping cgroup. Only the measurement
+ * threads join the partition, one by one with cgroup_isolate_thread(),
+ * which is why both cgroups are threaded: the root cgroup is their
+ * common threaded domain. Tasks living in other cgroups lose the
+ * isolated CPUs automatically once the partition becomes valid. Kernel
+ * threads refuse to be moved; unbound ones are kept off the partition by
+ * the kernel.
+ *
+ * The restore path only uses open/read/write/rmdir so it can also run
+ * from a fatal signal.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rt-utils.h"
+#include "rt-error.h"
+#include "rt-cgroup.h"
+
+#define CGROUP2_PATH		"/sys/fs/cgroup"
+#define CG_ISOLATED		"rt-tests.isolated"
+#define CG_HOUSEKEEPING		"rt-tests.housekeeping"
+#define CPULIST_SIZE		4096
+#define CG_PATH_MAX		(3 * MAX_PATH)
+
+static char cgroup_root[MAX_PATH];
+static char orig_cgroup[MAX_PATH + 8];
+static bool cpuset_enabled_by_us;
+static bool isolated;
+static pid_t owner;
+
+static int find_cgroup2_mount(void)
+{
+	struct statfs st_fs;
+	char mnt[MAX_PATH], type[100];
+	FILE *fp;
+
+	if (!statfs(CGROUP2_PATH, &st_fs) &&
+	    (long)st_fs.f_type == CGROUP2_SUPER_MAGIC) {
+		strcpy(cgroup_root, CGROUP2_PATH);
+		return 0;
+	}
+
+	fp = fopen("/proc/mounts", "r");
+	if (!fp)
+		return -errno;
+
+	while (fscanf(fp, "%*s %" STR(MAX_PATH) "s %99s %*s %*d %*d\n",
+		      mnt, type) == 2) {
+		if (!strcmp(type, "cgroup2")) {
+			strcpy(cgroup_root, mnt);
+			fclose(fp);
+			return 0;
+		}
+	}
+	fclose(fp);
+
+	return -ENODEV;
+}
+
+/* Without snprintf(), which is not async-signal-safe */
+static void cg_path(char *path, const char *cgroup, const char *file)
+{
+	strcpy(path, cgroup_root);
+	strcat(path, "/");
+	strcat(path, cgroup);
+	if (file) {
+		strcat(path, "/");
+		strcat(path, file);
+	}
+}
+
+static char *fmt_pid(char *buf, pid_t pid)
+{
+	char tmp[16];
+	int n = 0;
+
+	do {
+		tmp[n++] = '0' + pid % 10;
+		pid /= 10;
+	} while (pid);
+
+	while (n)
+		*buf++ = tmp[--n];
+	*buf = '\0';
+
+	return buf;
+}
+
+static int cg_write(const char *cgroup, const char *file, const char *val)
+{
+	char path[CG_PATH_MAX];
+	int fd, ret = 0;
+
+	cg_path(path, cgroup, file);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (write(fd, val, strlen(val)) < 0)
+		ret = -errno;
+	close(fd);
+
+	return ret;
+}
+
+static int cg_read(const char *cgroup, const char *file, char *buf, size_t len)
+{
+	char path[CG_PATH_MAX];
+	ssize_t n;
+	int fd;
+
+	cg_path(path, cgroup, file);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -errno;
+
+	buf[n] = '\0';
+	if (n && buf[n - 1] == '\n')
+		buf[n - 1] = '\0';
+
+	return 0;
+}
+
+/*
+ * Move all processes listed in @list ("cgroup.procs" or "cgroup.threads")
+ * of @from into @to. A thread id written to cgroup.procs moves its whole
+ * process. Returns the number of processes which could not be moved.
+ */
+static int cg_move_procs(const char *from, const char *list, const char *to)
+{
+	char path[CG_PATH_MAX];
+	char buf[4096], pid[16];
+	bool digits = false;
+	int failed = 0;
+	pid_t p = 0;
+	ssize_t n, i;
+	int fd, ret;
+
+	cg_path(path, from, list);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	/* one pid per line, the last line ends with a newline as well */
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < n; i++) {
+			if (isdigit(buf[i])) {
+				p = p * 10 + buf[i] - '0';
+				digits = true;
+				continue;
+			}
+			if (digits) {
+				fmt_pid(pid, p);
+				/*
+				 * tasks come and go, kernel threads can't
+				 * be moved at all
+				 */
+				ret = cg_write(to, "cgroup.procs", pid);
+				if (ret && ret != -ESRCH)
+					failed++;
+			}
+			p = 0;
+			digits = false;
+		}
+	}
+	close(fd);
+
+	return failed;
+}
+
+static int read_online_cpus(cpu_set_t *set)
+{
+	char buf[CPULIST_SIZE];
+	FILE *fp;
+	int ret = -EIO;
+
+	fp = fopen("/sys/devices/system/cpu/online", "r");
+	if (!fp)
+		return -errno;
+	if (fgets(buf, sizeof(buf), fp))
+		ret = parse_cpulist(buf, set);
+	fclose(fp);
+
+	return ret;
+}
+
+static void save_own_cgroup(void)
+{
+	char line[MAX_PATH + 8];
+	FILE *fp;
+
+	orig_cgroup[0] = '\0';
+	fp = fopen("/proc/self/cgroup", "r");
+	if (!fp)
+		return;
+
+	/* the unified hierarchy shows up as "0::/path" */
+	while (fgets(line, sizeof(line), fp)) {
+		if (strncmp(line, "0::/", 4))
+			continue;
+		line[strcspn(line, "\n")] = '\0';
+		strcpy(orig_cgroup, line + 4);
+		break;
+	}
+	fclose(fp);
+}
+
+static int make_cgroup(const char *name, const char *cpus)
+{
+	char path[CG_PATH_MAX];
+	int ret;
+
+	cg_path(path, name, NULL);
+	if (mkdir(path, 0755) < 0 && errno != EEXIST)
+		return -errno;
+
+	ret = cg_write(name, "cgroup.type", "threaded");
+	if (ret)
+		return ret;
+
+	return cg_write(name, "cpuset.cpus", cpus);
+}
+
+static void cg_restore(bool verbose)
+{
+	char path[CG_PATH_MAX];
+	char pid[16];
+
+	/* forked children inherit the atexit() handler */
+	if (!isolated || getpid() != owner)
+		return;
+	isolated = false;
+
+	fmt_pid(pid, getpid());
+	if (cg_write(orig_cgroup[0] ? orig_cgroup : ".", "cgroup.procs", pid))
+		cg_write(".", "cgroup.procs", pid);
+
+	/*
+	 * Children of moved tasks ended up here as well, move them all.
+	 * cgroup.procs can't be read in a threaded cgroup.
+	 */
+	cg_move_procs(CG_ISOLATED, "cgroup.threads", ".");
+	cg_move_procs(CG_HOUSEKEEPING, "cgroup.threads", ".");
+
+	cg_write(CG_ISOLATED, "cpuset.cpus.partition", "member");
+
+	cg_path(path, CG_ISOLATED, NULL);
+	if (rmdir(path) < 0 && errno != ENOENT && verbose)
+		err_msg_n(errno, "WARN: could not remove %s", path);
+	cg_path(path, CG_HOUSEKEEPING, NULL);
+	if (rmdir(path) < 0 && errno != ENOENT && verbose)
+		err_msg_n(errno, "WARN: could not remove %s", path);
+
+	if (cpuset_enabled_by_us) {
+		cg_write(".", "cgroup.subtree_control", "-cpuset");
+		cpuset_enabled_by_us = false;
+	}
+}
+
+/* Called from a fatal signal, don't print anything */
+static void cgroup_restore_signal(void)
+{
+	cg_restore(false);
+}
+
+/*
+ * cgroup_isolate - isolate the CPUs in @cpus with a cgroup v2 partition
+ * @cpus: CPU list, e.g. "2-5,7"
+ * @type: CGROUP_ISOLATED for a partition without load balancing,
+ *        CGROUP_ROOT for a load balanced one (a root domain of its own)
+ *
+ * Moves the calling process into the housekeeping cgroup. The threads
+ * which measure join the partition with cgroup_isolate_thread(). The
+ * previous state is restored by cgroup_restore(), which is also
+ * registered with atexit(). Fatal signals which are not handled by the
+ * caller restore it as well.
+ *
+ * Returns 0 on success, negative errno on failure.
+ */
+int cgroup_isolate(const char *cpus, enum cgroup_partition type)
+{
+	cpu_set_t req, iso, online, hk;
+	char buf[CPULIST_SIZE];
+	char pid[32];
+	static bool registered;
+	int failed, ret;
+
+	if (isolated)
+		return -EBUSY;
+
+	ret = find_cgroup2_mount();
+	if (ret) {
+		warn("cgroup v2 is not mounted\n");
+		return ret;
+	}
+
+	if (parse_cpulist(cpus, &req)) {
+		warn("invalid cpu list '%s'\n", cpus);
+		return -EINVAL;
+	}
+
+	ret = read_online_cpus(&online);
+	if (ret)
+		return ret;
+
+	CPU_AND(&iso, &req, &online);
+	if (!CPU_EQUAL(&iso, &req)) {
+		warn("cpu list '%s' contains offline cpus\n", cpus);
+		return -EINVAL;
+	}
+	CPU_XOR(&hk, &online, &iso);
+	if (!CPU_COUNT(&iso) || !CPU_COUNT(&hk)) {
+		warn("need at least one isolated and one housekeeping cpu\n");
+		return -EINVAL;
+	}
+
+	ret = cg_read(".", "cgroup.subtree_control", buf, sizeof(buf));
+	if (ret)
+		return ret;
+	if (!strstr(buf, "cpuset")) {
+		ret = cg_write(".", "cgroup.subtree_control", "+cpuset");
+		if (ret) {
+			warn("could not enable the cpuset controller\n");
+			return ret;
+		}
+		cpuset_enabled_by_us = true;
+	}
+
+	if (!registered) {
+		atexit(cgroup_restore);
+		cleanup_on_signal(cgroup_restore_signal);
+		registered = true;
+	}
+	isolated = true;
+	owner = getpid();
+	save_own_cgroup();
+
+	format_cpulist(&hk, buf, sizeof(buf));
+	ret = make_cgroup(CG_HOUSEKEEPING, buf);
+	if (ret) {
+		warn("could not create %s (cpus %s)\n", CG_HOUSEKEEPING, buf);
+		goto fail;
+	}
+
+	format_cpulist(&iso, buf, sizeof(buf));
+	ret = make_cgroup(CG_ISOLATED, buf);
+	if (ret) {
+		warn("could not create %s (cpus %s)\n", CG_ISOLATED, buf);
+		goto fail;
+	}
+
+	/* "isolated" needs v6.1, fall back to a load balanced partition */
+	if ((type != CGROUP_ISOLATED ||
+	     cg_write(CG_ISOLATED, "cpuset.cpus.partition", "isolated")) &&
+	    cg_write(CG_ISOLATED, "cpuset.cpus.partition", "root")) {
+		warn("kernel does not support cpuset partitions\n");
+		ret = -ENOTSUP;
+		goto fail;
+	}
+
+	if (!cg_read(CG_ISOLATED, "cpuset.cpus.partition", buf, sizeof(buf)) &&
+	    strstr(buf, "invalid"))
+		warn("%s: partition is %s\n", CG_ISOLATED, buf);
+
+	fmt_pid(pid, getpid());
+	ret = cg_write(CG_HOUSEKEEPING, "cgroup.procs", pid);
+	if (ret) {
+		warn("could not move into %s\n", CG_HOUSEKEEPING);
+		goto fail;
+	}
+
+	failed = cg_move_procs(".", "cgroup.procs", CG_HOUSEKEEPING);
+	if (failed > 0)
+		info(1, "%d tasks (kernel threads) stay in the root cgroup\n",
+		     failed);
+
+	return 0;
+
+fail:
+	cgroup_restore();
+	return ret;
+}
+
+/*
+ * cgroup_isolate_thread - move a thread into the isolated partition
+ * @tid: thread id, 0 for the calling thread
+ *
+ * Has to be called before the thread pins itself to an isolated CPU,
+ * the housekeeping cgroup does not allow those. Works for threads of
+ * forked children as well.
+ *
+ * Returns 0 on success, negative errno on failure.
+ */
+int cgroup_isolate_thread(pid_t tid)
+{
+	char buf[16];
+
+	if (!isolated)
+		return -EINVAL;
+
+	fmt_pid(buf, tid ? tid : gettid());
+
+	return cg_write(CG_ISOLATED, "cgroup.threads", buf);
+}
+
+/*
+ * cgroup_restore - undo cgroup_isolate()
+ *
+ * Safe to call multiple times.
+ */
+void cgroup_restore(void)
+{
+	cg_restore(true);
+}
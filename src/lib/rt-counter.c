@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Frequency of the architecture's free running counter
+ *
+ * Taken from the architecture where it tells: CNTFRQ on arm64, CPUCFG on
+ * LoongArch, the device tree on RISC-V, and on x86 the tsc_freq_khz file
+ * of CPU 0 or the crystal ratio of CPUID leaf 0x15. Otherwise the counter
+ * is calibrated against CLOCK_MONOTONIC_RAW once per boot and the result
+ * is cached together with the boot id. A cached value is only trusted if
+ * the file belongs to us and a short calibration agrees with it.
+ */
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rt-utils.h"
+#include "rt-counter.h"
+
+/* Length of one calibration of the counter against CLOCK_MONOTONIC_RAW */
+#define CALIBRATE_NS	(10 * 1000 * 1000)
+#define BOOT_ID		"/proc/sys/kernel/random/boot_id"
+/* Allowed deviation of a single calibration from a cached value */
+#define CACHE_TOLERANCE	100	/* 1% */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+
+/* Exported by some kernels, the frequency the kernel settled on */
+#define TSC_FREQ_KHZ	"/sys/devices/system/cpu/cpu0/tsc_freq_khz"
+
+static uint64_t arch_counter_hz(void)
+{
+	unsigned int eax, ebx, ecx, edx, max;
+	unsigned int base_mhz, ebx16, ecx16, edx16;
+	uint64_t crystal_hz;
+	unsigned long khz;
+	FILE *f;
+
+	f = fopen(TSC_FREQ_KHZ, "r");
+	if (f) {
+		if (fscanf(f, "%lu", &khz) != 1)
+			khz = 0;
+		fclose(f);
+		if (khz)
+			return khz * 1000;
+	}
+
+	max = __get_cpuid_max(0, NULL);
+	if (max < 0x15)
+		return 0;
+
+	/* TSC to core crystal clock ratio, crystal frequency in Hz */
+	__cpuid(0x15, eax, ebx, ecx, edx);
+	if (!eax || !ebx)
+		return 0;
+	crystal_hz = ecx;
+
+	/*
+	 * Like native_calibrate_tsc() of Linux, derive a missing crystal
+	 * frequency from the base frequency of leaf 0x16. That is not the
+	 * TSC frequency by itself, so without the ratio we calibrate.
+	 */
+	if (!crystal_hz && max >= 0x16) {
+		__cpuid(0x16, base_mhz, ebx16, ecx16, edx16);
+		crystal_hz = (uint64_t)base_mhz * 1000000 * eax / ebx;
+	}
+
+	/* kHz resolution, like the tsc_khz of Linux */
+	return crystal_hz * ebx / eax / 1000 * 1000;
+}
+#elif defined(__aarch64__)
+static uint64_t arch_counter_hz(void)
+{
+	uint64_t val;
+
+	__asm__ __volatile__("mrs %0, cntfrq_el0" : "=r" (val));
+
+	return val;
+}
+#elif defined(__loongarch64)
+#define LOONGARCH_CPUCFG4	0x4	/* constant counter base frequency */
+#define LOONGARCH_CPUCFG5	0x5	/* constant counter multiplier/divider */
+
+static inline unsigned int read_cpucfg(unsigned int reg)
+{
+	unsigned int val;
+
+	__asm__ __volatile__("cpucfg %0, %1" : "=r" (val) : "r" (reg));
+
+	return val;
+}
+
+/* See calc_const_freq() of Linux */
+static uint64_t arch_counter_hz(void)
+{
+	uint64_t base_freq, cfm, cfd;
+	unsigned int res;
+
+	base_freq = read_cpucfg(LOONGARCH_CPUCFG4);
+	res = read_cpucfg(LOONGARCH_CPUCFG5);
+	cfm = res & 0xffff;
+	cfd = (res >> 16) & 0xffff;
+
+	if (!base_freq || !cfm || !cfd)
+		return 0;
+
+	return base_freq * cfm / cfd;
+}
+#elif defined(__riscv) && __riscv_xlen == 64
+#define RISCV_TIMEBASE_FREQ	"/proc/device-tree/cpus/timebase-frequency"
+
+/* The time CSR ticks at the timebase-frequency of the device tree */
+static uint64_t arch_counter_hz(void)
+{
+	unsigned char buf[4];
+	uint32_t freq;
+	FILE *f;
+
+	f = fopen(RISCV_TIMEBASE_FREQ, "r");
+	if (!f)
+		return 0;
+	if (fread(buf, 1, sizeof(buf), f) != sizeof(buf)) {
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+
+	/* device tree cells are big endian */
+	freq = buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3];
+
+	return freq;
+}
+#else
+static uint64_t arch_counter_hz(void)
+{
+#ifdef COUNTER_MISSING
+	/* counter_read() returns ns */
+	return NSEC_PER_SEC;
+#else
+	return 0;
+#endif
+}
+#endif
+
+static uint64_t __measure_counter_hz(void)
+{
+	struct timespec ts, te;
+	uint64_t s, e;
+	int64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	s = counter_read();
+	do {
+		e = counter_read();
+		clock_gettime(CLOCK_MONOTONIC_RAW, &te);
+		ns = calcdiff_ns(te, ts);
+	} while (ns < CALIBRATE_NS);
+
+	return (e - s) * NSEC_PER_SEC / ns;
+}
+
+/* Calibrate until two runs agree within 0.1% */
+static uint64_t measure_counter_hz(void)
+{
+	uint64_t m, mprev, d;
+
+	mprev = __measure_counter_hz();
+	do {
+		m = __measure_counter_hz();
+		if (m > mprev)
+			d = m - mprev;
+		else
+			d = mprev - m;
+		mprev = m;
+	} while (d > m / 1000);
+
+	/* kHz resolution is still well below the calibration's accuracy */
+	return m >= 1000000 ? (m + 500) / 1000 * 1000 : m;
+}
+
+/*
+ * The cache lives in a world writable directory, only use a regular file
+ * of our own and check it against a quick calibration.
+ */
+static uint64_t read_cache(const char *cache, const char *boot_id)
+{
+	char cached_id[64];
+	unsigned long long cached = 0;
+	uint64_t hz, d;
+	struct stat st;
+	FILE *f;
+	int fd;
+
+	fd = open(cache, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_uid != geteuid()) {
+		close(fd);
+		return 0;
+	}
+	f = fdopen(fd, "r");
+	if (!f) {
+		close(fd);
+		return 0;
+	}
+	if (fscanf(f, "%63s %llu", cached_id, &cached) != 2 ||
+	    strcmp(cached_id, boot_id))
+		cached = 0;
+	fclose(f);
+	if (!cached)
+		return 0;
+
+	hz = __measure_counter_hz();
+	d = hz > cached ? hz - cached : cached - hz;
+	if (d > hz / CACHE_TOLERANCE)
+		return 0;
+
+	return cached;
+}
+
+static int read_boot_id(char *buf, size_t len)
+{
+	FILE *f = fopen(BOOT_ID, "r");
+	int ret = -1;
+
+	if (!f)
+		return -1;
+	if (fgets(buf, len, f)) {
+		buf[strcspn(buf, "\n")] = '\0';
+		ret = 0;
+	}
+	fclose(f);
+
+	return ret;
+}
+
+/*
+ * counter_hz - frequency of the counter of counter_read() in Hz
+ * @cache: file for the result of a calibration, NULL to not cache it
+ *
+ * From the architecture if it tells, otherwise calibrated once per boot.
+ */
+uint64_t counter_hz(const char *cache)
+{
+	char boot_id[64];
+	uint64_t hz;
+	bool have_id;
+	int fd;
+
+	hz = arch_counter_hz();
+	if (hz)
+		return hz;
+
+	have_id = cache && !read_boot_id(boot_id, sizeof(boot_id));
+	hz = have_id ? read_cache(cache, boot_id) : 0;
+	if (hz)
+		return hz;
+
+	hz = measure_counter_hz();
+
+	/* a world writable directory, don't follow planted links */
+	fd = have_id ? open(cache, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW,
+			    0644) : -1;
+	if (fd >= 0) {
+		dprintf(fd, "%s %llu\n", boot_id, (unsigned long long)hz);
+		close(fd);
+	}
+
+	return hz;
+}
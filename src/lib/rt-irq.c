@@ -0,0 +1,263 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * IRQ affinity steering
+ *
+ * Moves all interrupts which allow it off the measurement CPUs and puts
+ * the original affinities back when the test exits. The restore path
+ * only uses open/write/close so it can also run from a fatal signal.
+ */
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rt-utils.h"
+#include "rt-error.h"
+#include "rt-irq.h"
+
+#define PROC_IRQ		"/proc/irq"
+#define CPULIST_SIZE		4096
+
+struct irq_affinity {
+	char path[64];
+	char *cpus;
+	size_t len;
+};
+
+static struct irq_affinity *saved;
+static int nr_saved;
+static bool steered;
+static pid_t owner;
+
+static int read_file(const char *path, char *buf, size_t len)
+{
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -errno;
+
+	buf[n] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+
+	return 0;
+}
+
+static int write_file(const char *path, const char *val, size_t len)
+{
+	int fd, ret = 0;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (write(fd, val, len) < 0)
+		ret = -errno;
+	close(fd);
+
+	return ret;
+}
+
+/* default_smp_affinity only takes a hex mask of 32 bit words */
+static int format_cpumask(cpu_set_t *set, char *buf, size_t len)
+{
+	int words = 1, off = 0, w, cpu, n;
+	unsigned int val;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, set))
+			words = cpu / 32 + 1;
+
+	for (w = words - 1; w >= 0; w--) {
+		val = 0;
+		for (cpu = 0; cpu < 32; cpu++)
+			if (CPU_ISSET(w * 32 + cpu, set))
+				val |= 1U << cpu;
+		n = snprintf(buf + off, len - off,
+			     w == words - 1 ? "%x" : ",%08x", val);
+		if (n >= len - off)
+			return -ENOSPC;
+		off += n;
+	}
+
+	return off;
+}
+
+static void irq_restore_affinities(void)
+{
+	int i;
+
+	for (i = 0; i < nr_saved; i++)
+		write_file(saved[i].path, saved[i].cpus, saved[i].len);
+}
+
+/* Called from a fatal signal, don't free anything */
+static void irq_restore_signal(void)
+{
+	if (steered && getpid() == owner) {
+		irq_restore_affinities();
+		steered = false;
+	}
+}
+
+static int irq_save(const char *path)
+{
+	struct irq_affinity *tmp;
+	char buf[CPULIST_SIZE];
+	int ret;
+
+	ret = read_file(path, buf, sizeof(buf));
+	if (ret)
+		return ret;
+
+	tmp = realloc(saved, (nr_saved + 1) * sizeof(*saved));
+	if (!tmp)
+		return -ENOMEM;
+	saved = tmp;
+
+	tmp = &saved[nr_saved];
+	strcpy(tmp->path, path);
+	tmp->cpus = strdup(buf);
+	if (!tmp->cpus)
+		return -ENOMEM;
+	tmp->len = strlen(buf);
+	nr_saved++;
+
+	return 0;
+}
+
+/*
+ * irq_steer_away - route all IRQs to the CPUs not in @cpus
+ * @cpus: the measurement CPUs as a cpu list
+ *
+ * IRQs registered later follow /proc/irq/default_smp_affinity, so it is
+ * pointed at the housekeeping CPUs as well. The current affinity of
+ * every IRQ and the default are saved first and written back by
+ * irq_restore(), which is registered with atexit(). Fatal signals which
+ * are not handled by the caller restore the affinities as well.
+ *
+ * Returns the number of IRQs which refused to move, negative errno on
+ * failure.
+ */
+int irq_steer_away(const char *cpus)
+{
+	char refused[CPULIST_SIZE];
+	char hk_cpus[CPULIST_SIZE];
+	char hk_mask[CPULIST_SIZE];
+	char path[64];
+	static bool registered;
+	cpu_set_t hk;
+	struct dirent *d;
+	size_t off = 0;
+	int nr_refused = 0;
+	int len, mask_len, ret;
+	DIR *dir;
+
+	if (steered)
+		return -EBUSY;
+
+	ret = housekeeping_cpus(cpus, &hk);
+	if (ret)
+		return ret;
+
+	len = 0;
+	if (CPU_COUNT(&hk))
+		len = format_cpulist(&hk, hk_cpus, sizeof(hk_cpus));
+	mask_len = format_cpumask(&hk, hk_mask, sizeof(hk_mask));
+	if (len <= 0 || mask_len <= 0) {
+		warn("no housekeeping cpus left to steer IRQs to\n");
+		return -EINVAL;
+	}
+
+	dir = opendir(PROC_IRQ);
+	if (!dir)
+		return -errno;
+
+	if (!registered) {
+		atexit(irq_restore);
+		cleanup_on_signal(irq_restore_signal);
+		registered = true;
+	}
+	owner = getpid();
+	steered = true;
+
+	ret = irq_save(PROC_IRQ "/default_smp_affinity");
+	if (ret == -ENOMEM) {
+		closedir(dir);
+		irq_restore();
+		return ret;
+	}
+	if (!ret && write_file(PROC_IRQ "/default_smp_affinity",
+			       hk_mask, mask_len))
+		warn("could not set the default IRQ affinity to cpus %s\n",
+		     hk_cpus);
+
+	refused[0] = '\0';
+	while ((d = readdir(dir))) {
+		if (!isdigit(d->d_name[0]))
+			continue;
+
+		snprintf(path, sizeof(path), PROC_IRQ "/%.16s/smp_affinity_list",
+			 d->d_name);
+		ret = irq_save(path);
+		if (ret == -ENOMEM) {
+			closedir(dir);
+			irq_restore();
+			return ret;
+		}
+		if (ret)
+			continue;
+
+		/* per-cpu and managed interrupts can't be moved */
+		if (write_file(path, hk_cpus, len)) {
+			nr_refused++;
+			if (off < sizeof(refused))
+				off += snprintf(refused + off,
+						sizeof(refused) - off, "%s%s",
+						off ? "," : "", d->d_name);
+		}
+	}
+	closedir(dir);
+
+	if (nr_refused)
+		warn("%d IRQs refused to move to cpus %s: %s\n",
+		     nr_refused, hk_cpus, refused);
+
+	return nr_refused;
+}
+
+/*
+ * irq_restore - write back the IRQ affinities saved by irq_steer_away()
+ *
+ * Safe to call multiple times.
+ */
+void irq_restore(void)
+{
+	int i;
+
+	/* forked children inherit the atexit() handler */
+	if (!steered || getpid() != owner)
+		return;
+	steered = false;
+
+	irq_restore_affinities();
+
+	for (i = 0; i < nr_saved; i++)
+		free(saved[i].cpus);
+	free(saved);
+	saved = NULL;
+	nr_saved = 0;
+}
@@ -146,3 +146,14 @@ int parse_cpumask(char *str, int max_cpus, struct bitmask **cpumask)
 
 	return 0;
 }
+
+/* Copy the cpus in cpumask into set, e.g. for format_cpulist() */
+void cpumask_to_cpuset(struct bitmask *cpumask, cpu_set_t *set)
+{
+	unsigned int cpu;
+
+	CPU_ZERO(set);
+	for (cpu = 0; cpu < cpumask->size && cpu < CPU_SETSIZE; cpu++)
+		if (numa_bitmask_isbitset(cpumask, cpu))
+			CPU_SET(cpu, set);
+}
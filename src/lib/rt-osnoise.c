@@ -0,0 +1,486 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Noise source attribution with the osnoise tracepoints
+ *
+ * Runs the osnoise tracer without its own workload (NO_OSNOISE_WORKLOAD,
+ * v6.3+) in a private ftrace instance, so the irq/softirq/thread/nmi
+ * noise tracepoints fire for whatever runs on the measured CPUs. A reader
+ * thread drains the per CPU trace pipes and keeps the events in memory,
+ * with their end time on CLOCK_MONOTONIC (the instance uses the mono
+ * trace clock), so they can be matched against gaps seen by a test.
+ *
+ * The osnoise/cpus and osnoise/options files are global and restored on
+ * osnoise_stop() and at exit.
+ */
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rt-utils.h"
+#include "rt-error.h"
+#include "rt-osnoise.h"
+
+#define TRACEFS_PATH		"/sys/kernel/tracing/"
+#define OSNOISE_INSTANCE	"instances/rt-tests-osnoise"
+#define OSNOISE_BUFFER_KB	"8192"
+#define NOISE_MAX_EVENTS	(1 << 20)
+#define PIPE_BUF_SIZE		8192
+
+const char * const noise_source_names[NR_NOISE_SOURCES] = {
+	[NOISE_NMI]	= "nmi",
+	[NOISE_IRQ]	= "irq",
+	[NOISE_SOFTIRQ]	= "softirq",
+	[NOISE_THREAD]	= "thread",
+};
+
+/*
+ * Markers in the trace_pipe output. Each line carries one of them and
+ * the leading ": " keeps irq_noise from matching inside softirq_noise,
+ * so the order of the table doesn't matter.
+ */
+static const struct {
+	const char *marker;
+	enum noise_source source;
+} noise_markers[] = {
+	{ ": nmi_noise: ",	NOISE_NMI },
+	{ ": softirq_noise: ",	NOISE_SOFTIRQ },
+	{ ": irq_noise: ",	NOISE_IRQ },
+	{ ": thread_noise: ",	NOISE_THREAD },
+};
+
+struct pipe_reader {
+	int cpu;
+	int fd;
+	size_t len;
+	char buf[PIPE_BUF_SIZE];
+};
+
+static char tracefs[MAX_PATH];
+static char instance[MAX_PATH + 32];
+static char saved_cpus[4096];
+static bool workload_was_on;
+static bool running;
+static pid_t owner;
+
+static struct noise_cpu *noise_cpus;
+static struct pipe_reader *readers;
+static int nr_readers;
+static pthread_t reader_thread;
+static volatile bool reader_stop;
+
+static int write_file(const char *dir, const char *file, const char *val)
+{
+	char path[2 * MAX_PATH];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fd = open(path, O_WRONLY | O_TRUNC);
+	if (fd < 0)
+		return -errno;
+	if (write(fd, val, strlen(val)) < 0)
+		ret = -errno;
+	close(fd);
+
+	return ret;
+}
+
+static int read_file(const char *dir, const char *file, char *buf, size_t len)
+{
+	char path[2 * MAX_PATH];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -errno;
+	buf[n] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+
+	return 0;
+}
+
+static int find_tracefs(void)
+{
+	struct stat st;
+	char *prefix;
+
+	if (!stat(TRACEFS_PATH "osnoise", &st)) {
+		strcpy(tracefs, TRACEFS_PATH);
+		return 0;
+	}
+
+	prefix = get_debugfileprefix();
+	if (prefix[0]) {
+		snprintf(tracefs, sizeof(tracefs), "%s", prefix);
+		return 0;
+	}
+
+	return -ENODEV;
+}
+
+static void add_event(int cpu, struct noise_event *ev)
+{
+	struct noise_cpu *nc = &noise_cpus[cpu];
+	struct noise_event *tmp;
+	size_t size;
+
+	if (nc->nr == nc->size) {
+		if (nc->size >= NOISE_MAX_EVENTS) {
+			nc->lost++;
+			return;
+		}
+		size = nc->size ? nc->size * 2 : 1024;
+		tmp = realloc(nc->events, size * sizeof(*tmp));
+		if (!tmp) {
+			nc->lost++;
+			return;
+		}
+		nc->events = tmp;
+		nc->size = size;
+	}
+	nc->events[nc->nr++] = *ev;
+}
+
+/*
+ * Parse one trace_pipe line, e.g.
+ *   <idle>-0 [002] d.h.. 1234.567890: irq_noise: local_timer:236 start 1234.567880000 duration 5000 ns
+ *
+ * The record timestamp is taken at the end of the noise; the start field
+ * uses the tracer's local clock, so it isn't used.
+ */
+static void parse_line(int cpu, char *line)
+{
+	unsigned long long sec, usec, duration;
+	struct noise_event ev;
+	char *m, *ts, *desc, *start, *colon;
+	unsigned int i;
+	int n;
+
+	m = strstr(line, "[LOST ");
+	if (m) {
+		if (sscanf(m, "[LOST %llu", &duration) == 1)
+			noise_cpus[cpu].lost += duration;
+		return;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(noise_markers); i++) {
+		m = strstr(line, noise_markers[i].marker);
+		if (m)
+			break;
+	}
+	if (!m)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.source = noise_markers[i].source;
+	desc = m + strlen(noise_markers[i].marker);
+
+	/* timestamp is the last field before the marker */
+	*m = '\0';
+	ts = strrchr(line, ' ');
+	ts = ts ? ts + 1 : line;
+	if (sscanf(ts, "%llu.%llu", &sec, &usec) != 2)
+		return;
+
+	start = strstr(desc, "start ");
+	if (!start || sscanf(strstr(start, "duration "), "duration %llu",
+			     &duration) != 1)
+		return;
+
+	if (ev.source != NOISE_NMI) {
+		*start = '\0';
+		while (*desc == ' ')
+			desc++;
+		colon = strrchr(desc, ':');
+		if (colon) {
+			ev.id = atoi(colon + 1);
+			*colon = '\0';
+		}
+		snprintf(ev.desc, sizeof(ev.desc), "%s", desc);
+		n = strlen(ev.desc);
+		while (n && ev.desc[n - 1] == ' ')
+			ev.desc[--n] = '\0';
+	}
+
+	ev.end = sec * NSEC_PER_SEC + usec * 1000;
+	ev.duration = duration;
+	add_event(cpu, &ev);
+}
+
+static void drain(struct pipe_reader *r)
+{
+	char *line, *nl;
+	ssize_t n;
+
+	for (;;) {
+		n = read(r->fd, r->buf + r->len, sizeof(r->buf) - r->len - 1);
+		if (n <= 0)
+			return;
+		r->len += n;
+		r->buf[r->len] = '\0';
+
+		line = r->buf;
+		while ((nl = strchr(line, '\n'))) {
+			*nl = '\0';
+			parse_line(r->cpu, line);
+			line = nl + 1;
+		}
+		r->len -= line - r->buf;
+		memmove(r->buf, line, r->len);
+
+		/* a line longer than the buffer, drop it */
+		if (r->len == sizeof(r->buf) - 1)
+			r->len = 0;
+	}
+}
+
+static void *reader_main(void *arg)
+{
+	struct pollfd *pfd;
+	bool last = false;
+	int i;
+
+	pfd = calloc(nr_readers, sizeof(*pfd));
+	if (!pfd)
+		return NULL;
+	for (i = 0; i < nr_readers; i++) {
+		pfd[i].fd = readers[i].fd;
+		pfd[i].events = POLLIN;
+	}
+
+	/* one more round after the stop request to pick up the rest */
+	while (!last) {
+		last = reader_stop;
+		poll(pfd, nr_readers, 100);
+		for (i = 0; i < nr_readers; i++)
+			drain(&readers[i]);
+	}
+	free(pfd);
+
+	return NULL;
+}
+
+static void osnoise_restore(void)
+{
+	char dir[MAX_PATH + 16];
+
+	snprintf(dir, sizeof(dir), "%sosnoise", tracefs);
+
+	write_file(instance, "tracing_on", "0");
+	write_file(instance, "current_tracer", "nop");
+	write_file(instance, "events/osnoise/enable", "0");
+	if (rmdir(instance) < 0 && errno != ENOENT)
+		warn("could not remove %s\n", instance);
+
+	write_file(dir, "cpus", saved_cpus);
+	if (workload_was_on)
+		write_file(dir, "options", "OSNOISE_WORKLOAD");
+}
+
+static void osnoise_atexit(void)
+{
+	/* forked children inherit the atexit() handler */
+	if (running && getpid() == owner)
+		osnoise_stop();
+}
+
+/*
+ * osnoise_start - record osnoise events on the cpus in @cpus
+ * @cpus: cpu list, e.g. "2-5,7"
+ *
+ * The events are collected by a reader thread which runs on the online
+ * cpus outside @cpus. Returns 0 on success, negative errno on failure.
+ */
+int osnoise_start(const char *cpus)
+{
+	static const char * const events[] = {
+		"nmi_noise", "irq_noise", "softirq_noise", "thread_noise",
+	};
+	char dir[MAX_PATH + 16], path[2 * MAX_PATH], buf[4096];
+	static bool registered;
+	pthread_attr_t attr;
+	cpu_set_t set, hk;
+	unsigned int i;
+	int cpu, ret;
+
+	if (running)
+		return -EBUSY;
+
+	if (parse_cpulist(cpus, &set))
+		return -EINVAL;
+
+	ret = find_tracefs();
+	if (ret) {
+		warn("tracefs is not mounted\n");
+		return ret;
+	}
+
+	snprintf(dir, sizeof(dir), "%sosnoise", tracefs);
+	if (read_file(dir, "cpus", saved_cpus, sizeof(saved_cpus)) ||
+	    read_file(dir, "options", buf, sizeof(buf))) {
+		warn("kernel has no osnoise tracer\n");
+		return -ENOTSUP;
+	}
+	workload_was_on = strstr(buf, "NO_OSNOISE_WORKLOAD") == NULL;
+	if (!strstr(buf, "OSNOISE_WORKLOAD")) {
+		warn("osnoise tracer lacks the OSNOISE_WORKLOAD option (v6.3+)\n");
+		return -ENOTSUP;
+	}
+
+	snprintf(instance, sizeof(instance), "%s" OSNOISE_INSTANCE, tracefs);
+	if (mkdir(instance, 0755) < 0 && errno != EEXIST) {
+		ret = -errno;
+		warn("could not create %s\n", instance);
+		return ret;
+	}
+
+	if (!registered) {
+		atexit(osnoise_atexit);
+		registered = true;
+	}
+	owner = getpid();
+
+	noise_cpus = calloc(CPU_SETSIZE, sizeof(*noise_cpus));
+	readers = calloc(CPU_COUNT(&set), sizeof(*readers));
+	if (!noise_cpus || !readers) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	/* don't let the tracer start its own busy loops on our cpus */
+	if ((ret = write_file(dir, "options", "NO_OSNOISE_WORKLOAD")) ||
+	    (ret = write_file(dir, "cpus", cpus)) ||
+	    (ret = write_file(instance, "trace_clock", "mono")) ||
+	    (ret = write_file(instance, "buffer_size_kb", OSNOISE_BUFFER_KB))) {
+		warn("could not configure the osnoise tracer\n");
+		goto fail;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(events); i++) {
+		snprintf(path, sizeof(path), "events/osnoise/%s/enable",
+			 events[i]);
+		ret = write_file(instance, path, "1");
+		if (ret) {
+			warn("could not enable osnoise:%s\n", events[i]);
+			goto fail;
+		}
+	}
+
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		struct pipe_reader *r = &readers[nr_readers];
+
+		if (!CPU_ISSET(cpu, &set))
+			continue;
+		snprintf(path, sizeof(path), "%s/per_cpu/cpu%d/trace_pipe",
+			 instance, cpu);
+		r->fd = open(path, O_RDONLY | O_NONBLOCK);
+		if (r->fd < 0) {
+			ret = -errno;
+			warn("could not open %s\n", path);
+			goto fail;
+		}
+		r->cpu = cpu;
+		nr_readers++;
+	}
+
+	ret = write_file(instance, "current_tracer", "osnoise");
+	if (ret) {
+		warn("could not start the osnoise tracer\n");
+		goto fail;
+	}
+	write_file(instance, "tracing_on", "1");
+
+	/*
+	 * The reader would inherit the affinity of the caller, which may
+	 * not be pinned yet; keep it off the measured cpus.
+	 */
+	ret = -pthread_attr_init(&attr);
+	if (ret)
+		goto fail;
+	if (!housekeeping_cpus(cpus, &hk) && CPU_COUNT(&hk))
+		pthread_attr_setaffinity_np(&attr, sizeof(hk), &hk);
+
+	running = true;
+	reader_stop = false;
+	ret = -pthread_create(&reader_thread, &attr, reader_main, NULL);
+	pthread_attr_destroy(&attr);
+	if (ret) {
+		running = false;
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	for (i = 0; i < nr_readers; i++)
+		close(readers[i].fd);
+	nr_readers = 0;
+	osnoise_restore();
+	return ret;
+}
+
+/*
+ * osnoise_stop - stop recording, the recorded events stay available
+ */
+void osnoise_stop(void)
+{
+	int i;
+
+	if (!running)
+		return;
+	running = false;
+
+	write_file(instance, "tracing_on", "0");
+	reader_stop = true;
+	pthread_join(reader_thread, NULL);
+
+	for (i = 0; i < nr_readers; i++)
+		close(readers[i].fd);
+	nr_readers = 0;
+
+	osnoise_restore();
+}
+
+/*
+ * osnoise_cpu - events recorded on @cpu, NULL if none were recorded
+ */
+struct noise_cpu *osnoise_cpu(int cpu)
+{
+	if (!noise_cpus || cpu < 0 || cpu >= CPU_SETSIZE)
+		return NULL;
+
+	return &noise_cpus[cpu];
+}
+
+/*
+ * osnoise_find - index of the first event of @nc ending at or after @start
+ */
+size_t osnoise_find(struct noise_cpu *nc, uint64_t start)
+{
+	size_t lo = 0, hi = nc->nr, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (nc->events[mid].end < start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
@@ -14,6 +14,7 @@
 #include <sched.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <signal.h>
 #include <ctype.h>
 #include <fcntl.h>
 #include <sys/types.h>
@@ -370,6 +371,161 @@ int parse_time_string(char *val)
 	return t;
 }
 
+/*
+ * Parse a cpu list like "0-3,6" into @set. Returns 0 on success,
+ * -EINVAL on malformed input.
+ */
+int parse_cpulist(const char *str, cpu_set_t *set)
+{
+	const char *p = str;
+	char *end;
+	long a, b;
+
+	CPU_ZERO(set);
+	while (*p) {
+		a = strtol(p, &end, 10);
+		if (end == p || a < 0)
+			return -EINVAL;
+		b = a;
+		p = end;
+		if (*p == '-') {
+			b = strtol(++p, &end, 10);
+			if (end == p || b < a)
+				return -EINVAL;
+			p = end;
+		}
+		if (b >= CPU_SETSIZE)
+			return -EINVAL;
+		for (; a <= b; a++)
+			CPU_SET(a, set);
+		if (*p == ',')
+			p++;
+		else if (*p && *p != '\n')
+			return -EINVAL;
+		else
+			break;
+	}
+
+	return 0;
+}
+
+/*
+ * Put the online cpus which are not in the cpu list @cpus into @hk.
+ * Returns 0 on success, negative errno on failure.
+ */
+int housekeeping_cpus(const char *cpus, cpu_set_t *hk)
+{
+	char buf[4096];
+	cpu_set_t iso;
+	ssize_t n;
+	int fd;
+
+	fd = open("/sys/devices/system/cpu/online", O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n < 0)
+		return -errno;
+	buf[n] = '\0';
+
+	if (parse_cpulist(buf, hk) || parse_cpulist(cpus, &iso))
+		return -EINVAL;
+
+	CPU_AND(&iso, &iso, hk);
+	CPU_XOR(hk, hk, &iso);
+
+	return 0;
+}
+
+/*
+ * Format @set as a cpu list like "0-3,6" into @buf. Returns the length
+ * of the list, -ENOSPC if it does not fit into @len bytes.
+ */
+int format_cpulist(cpu_set_t *set, char *buf, size_t len)
+{
+	size_t off = 0;
+	int cpu, last, n;
+
+	buf[0] = '\0';
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, set))
+			continue;
+		for (last = cpu; last + 1 < CPU_SETSIZE &&
+			     CPU_ISSET(last + 1, set); last++)
+			;
+		if (last == cpu)
+			n = snprintf(buf + off, len - off, "%s%d",
+				     off ? "," : "", cpu);
+		else
+			n = snprintf(buf + off, len - off, "%s%d-%d",
+				     off ? "," : "", cpu, last);
+		if (n >= len - off)
+			return -ENOSPC;
+		off += n;
+		cpu = last;
+	}
+
+	return off;
+}
+
+/* Fatal signals which would otherwise skip the atexit() handlers */
+static const int cleanup_signals[] = {
+	SIGHUP, SIGINT, SIGQUIT, SIGTERM,
+	SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT,
+};
+
+static void (*cleanups[8])(void);
+static volatile sig_atomic_t nr_cleanups;
+
+static void cleanup_sighand(int sig)
+{
+	int i;
+
+	for (i = nr_cleanups - 1; i >= 0; i--)
+		cleanups[i]();
+	/* SA_RESETHAND put the default action back in place */
+	raise(sig);
+}
+
+/*
+ * cleanup_on_signal - run @fn when the process is killed by a signal
+ * @fn: the cleanup, must be async-signal-safe
+ *
+ * The fatal signals which still have their default action get a handler
+ * running all registered cleanups, the latest first, before the signal
+ * kills the process. Signals the program handles itself are left alone,
+ * their handlers are expected to end in exit().
+ *
+ * Returns 0 on success, negative errno on failure.
+ */
+int cleanup_on_signal(void (*fn)(void))
+{
+	struct sigaction sa, old;
+	unsigned int i;
+
+	if (nr_cleanups == ARRAY_SIZE(cleanups))
+		return -ENOSPC;
+	cleanups[nr_cleanups] = fn;
+	nr_cleanups++;
+	if (nr_cleanups > 1)
+		return 0;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = cleanup_sighand;
+	sa.sa_flags = SA_RESETHAND;
+	sigfillset(&sa.sa_mask);
+
+	for (i = 0; i < ARRAY_SIZE(cleanup_signals); i++) {
+		if (sigaction(cleanup_signals[i], NULL, &old) ||
+		    old.sa_handler != SIG_DFL)
+			continue;
+		sigaction(cleanup_signals[i], &sa, NULL);
+	}
+
+	return 0;
+}
+
 int parse_mem_string(char *str, uint64_t *val)
 {
 	char *endptr;
@@ -534,6 +690,21 @@ void rt_init(int argc, char *argv[])
 	get_timestamp(ts_start);
 }
 
+/* Write @str as a quoted JSON string, command lines may contain quotes */
+void rt_write_json_string(FILE *f, const char *str)
+{
+	fputc('"', f);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(f, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(f, "\\u%04x", *str);
+		else
+			fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
 void rt_write_json(const char *filename, int return_code,
 		  void (*cb)(FILE *, void *),
 		  void *data)
@@ -568,7 +739,9 @@ void rt_write_json(const char *filename, int return_code,
 
 	fprintf(f, "{\n");
 	fprintf(f, "  \"file_version\": 1,\n");
-	fprintf(f, "  \"cmdline:\": \"%s\",\n", test_cmdline);
+	fprintf(f, "  \"cmdline:\": ");
+	rt_write_json_string(f, test_cmdline);
+	fprintf(f, ",\n");
 	fprintf(f, "  \"rt_test_version:\": \"%1.2f\",\n", VERSION);
 	fprintf(f, "  \"start_time\": \"%s\",\n", ts_start);
 	fprintf(f, "  \"end_time\": \"%s\",\n", ts_end);
@@ -41,73 +41,81 @@
 #include <sys/mman.h>
 #include <sys/syscall.h>
 
+#include <linux/futex.h>
+#include <linux/perf_event.h>
 #include <linux/unistd.h>
 
 #include "rt-utils.h"
 #include "rt-numa.h"
 #include "rt-error.h"
+#include "rt-cgroup.h"
+#include "rt-irq.h"
+#include "rt-osnoise.h"
+#include "rt-counter.h"
 
 #ifdef __GNUC__
 # define atomic_inc(ptr)   __sync_add_and_fetch((ptr), 1)
-# if defined(__x86_64__)
+# if defined(__x86_64__) || defined(__i386__)
 #  define relax()          __asm__ __volatile__("pause" ::: "memory")
-static inline void frc(uint64_t *pval)
-{
-	uint32_t low, high;
-	/* See rdtsc_ordered() of Linux */
-	__asm__ __volatile__("lfence");
-	__asm__ __volatile__("rdtsc" : "=a" (low), "=d" (high));
-	*pval = ((uint64_t) high << 32) | low;
-}
-# elif defined(__i386__)
-#  define relax()          __asm__ __volatile__("pause" ::: "memory")
-static inline void frc(uint64_t *pval)
-{
-	__asm__ __volatile__("rdtsc" : "=A" (*pval));
-}
-# elif defined(__PPC64__)
+# elif defined(__aarch64__)
+#  define relax()          __asm__ __volatile("yield" : : : "memory")
+# else
 #  define relax()          do { } while (0)
+# endif
+#else
+# error Need to add support for this compiler.
+#endif
+
+#ifdef COUNTER_MISSING
+# define FRC_MISSING
+#endif
+
 static inline void frc(uint64_t *pval)
 {
-	__asm__ __volatile__("mfspr %0, 268\n" : "=r" (*pval));
+	*pval = counter_read();
 }
-# elif defined(__aarch64__)
-#  define relax()          __asm__ __volatile("yield" : : : "memory")
 
-#define arch_measure_counter_mhz
-static unsigned int measure_counter_mhz(void)
-{
-	unsigned int val;
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
 
-	__asm__ __volatile__("mrs %0, cntfrq_el0" : "=r" (val));
+#define CURRENT_CLOCKSOURCE	\
+	"/sys/devices/system/clocksource/clocksource0/current_clocksource"
 
-	return val / 1e6;
+#define arch_rdpmc arch_rdpmc
+static inline uint64_t arch_rdpmc(unsigned int counter)
+{
+	uint32_t low, high;
+
+	__asm__ __volatile__("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+	return ((uint64_t) high << 32) | low;
 }
 
-static inline void frc(uint64_t *pval)
+#define arch_check_counter arch_check_counter
+static void arch_check_counter(void)
 {
-	/*
-	 * This isb() is required to prevent that the counter value
-	 * is speculated.
-	 */
-	__asm__ __volatile__("isb" : : : "memory");
-	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (*pval) :: "memory");
-	/*
-	 * This isb() is required to prevent the processor from accessing
-	 * memory appearing in program order after the read of the counter
-	 * before the counter has been read. Which would skew the counter value
-	 * to a later point than intended.
-	 */
-	__asm__ __volatile__("isb" : : : "memory");
+	unsigned int eax, ebx, ecx, edx;
+	char clocksource[32] = "";
+	FILE *f;
 
+	/* Invariant TSC: constant rate in all P-, C- and T-states */
+	if (__get_cpuid_max(0x80000000, NULL) < 0x80000007)
+		edx = 0;
+	else
+		__cpuid(0x80000007, eax, ebx, ecx, edx);
+	if (!(edx & (1 << 8)))
+		warn("the TSC is not invariant, frequency changes and idle states distort the results\n");
+
+	/* The kernel drops the TSC as clocksource when it finds it unstable */
+	f = fopen(CURRENT_CLOCKSOURCE, "r");
+	if (f) {
+		if (fscanf(f, "%31s", clocksource) != 1)
+			clocksource[0] = '\0';
+		fclose(f);
+	}
+	if (clocksource[0] && strcmp(clocksource, "tsc"))
+		warn("the kernel uses the %s clocksource, the TSC may be unstable\n",
+		     clocksource);
 }
-# else
-#  define relax()          do { } while (0)
-#  define frc(x)
-#  define FRC_MISSING
-# endif
-#else
-# error Need to add support for this compiler.
 #endif
 
 typedef uint64_t stamp_t;   /* timestamp */
@@ -125,6 +133,10 @@ enum command {
 enum workload_type {
 	WORKLOAD_NONE = 0,
 	WORKLOAD_MEMMOVE,
+	WORKLOAD_CHASE,
+	WORKLOAD_SIMD,
+	WORKLOAD_ATOMIC,
+	WORKLOAD_SYSCALL,
 	WORKLOAD_NUM,
 };
 
@@ -133,35 +145,172 @@ enum workload_type {
 
 typedef void (*workload_fn)(char *src, char *dst, size_t size);
 
+/*
+ * A workload runs once between two reads of the counter.  Workloads with
+ * WORK_NEED_MEM get two buffers of --workload-mem bytes, allocated on the
+ * NUMA node of the measuring thread, which w_init can prepare.
+ */
 struct workload {
 	const char *w_name;
 	uint64_t w_flags;
+	workload_fn w_init;
 	workload_fn w_fn;
 };
 
+#define  CACHE_LINE  (64)
+
+/* Where counter_hz() keeps the result of a calibration */
+#define  CALIBRATION_CACHE  "/var/tmp/oslat-counter-hz"
+
+/* Fan-in of the start barrier's arrival tree */
+#define  START_FANIN       (4)
+/* Head start for the release of the start barrier to reach every thread */
+#define  START_MARGIN_US   (100)
+
+/* Arrival flag of one thread in the start barrier, one per cache line */
+struct start_slot {
+	volatile unsigned int gen;
+} __attribute__((aligned(CACHE_LINE)));
+
+/* Dependent loads per pointer chase workload run */
+#define  CHASE_HOPS  (16)
+
 /* We'll have buckets 1us, 2us, ..., (BUCKET_SIZE) us. */
 #define  BUCKET_SIZE  (32)
 
+/*
+ * Fraction bits of the fixed point cycles to bucket factor.  Only samples
+ * below bucket_limit take the fixed point path, so the product stays below
+ * bucket_size << BUCKET_SHIFT, which leaves plenty of room in 64 bits.
+ */
+#define  BUCKET_SHIFT  (40)
+
+/* Capacity of the per thread log of interruptions above --log-threshold */
+#define  EVENT_LOG_SIZE  (1 << 16)
+/* Distinct noise descriptions (irq action, softirq, comm) per thread */
+#define  NOISE_DESC_SIZE  (64)
+/* Tolerance when matching osnoise events to interruptions */
+#define  NOISE_SLACK_NS   (2000)
+
+enum pmc_event {
+	PMC_CYCLES,
+	PMC_INSTRUCTIONS,
+	PMC_REF_CYCLES,
+	PMC_NUM,
+};
+
+struct interruption {
+	stamp_t              start;		/* counter value at the start */
+	cycles_t             duration;
+	/* --pmc: perf counter deltas over the interruption */
+	uint64_t             pmc[PMC_NUM];
+	/* --pmc: SMIs since the previous recorded interruption, -1 if unknown */
+	int64_t              smi;
+};
+
+/* osnoise events seen on a CPU during the run, durations in ns */
+struct noise_stat {
+	enum noise_source    source;
+	char                 desc[24];
+	uint64_t             count;
+	uint64_t             total;
+	uint64_t             max;
+};
+
+/* Histogram and extremes of one --stream window */
+struct window {
+	stamp_t              *buckets;
+	uint64_t             minlat;
+	uint64_t             maxlat;
+	uint64_t             overflow_sum;
+	stamp_t              start;
+	stamp_t              stop;
+};
+
+static const char * const pmc_names[PMC_NUM] = {
+	[PMC_CYCLES]		= "cycles",
+	[PMC_INSTRUCTIONS]	= "instructions",
+	[PMC_REF_CYCLES]	= "ref_cycles",
+};
+
+/* Overrides of --cpu-config for the CPUs in cpus, later ones win */
+struct cpu_config {
+	struct bitmask       *cpus;
+	struct workload      *workload;		/* NULL if not overridden */
+	uint64_t             workload_mem_size;	/* 0 if not overridden */
+	int                  rtprio;		/* -1 if not overridden */
+};
+
 /* Default size of the workloads per thread (in bytes, which is 16KB) */
 #define  WORKLOAD_MEM_SIZE  (16UL << 10)
 
+/*
+ * The chase workload defaults to a multiple of the LLC of its CPU, so
+ * most of its loads go to DRAM, or to this if the LLC is unknown
+ */
+#define  CHASE_LLC_FACTOR   (2)
+#define  CHASE_MEM_SIZE     (64UL << 20)
+
 /* By default, no workload */
 #define  WORKLOAD_DEFAULT  WORKLOAD_NONE
 
 struct thread {
 	int                  core_i;
+	unsigned int         index;
 	pthread_t            thread_id;
 
-	/* NOTE! this is also how many ticks per us */
-	unsigned int         counter_mhz;
+	/* Configuration of this thread, the global one unless overridden */
+	struct workload      *workload;
+	uint64_t             workload_mem_size;
+	int                  rtprio;
+
+	uint64_t             counter_hz;
 	cycles_t             int_total;
 	stamp_t              frc_start;
 	stamp_t              frc_stop;
 	cycles_t             runtime;
 	stamp_t              *buckets;
+	/* Min/max latency detected, in counter cycles */
 	uint64_t             minlat;
-	/* Maximum latency detected */
 	uint64_t             maxlat;
+	/* bucket index = (cycles * bucket_mult) >> BUCKET_SHIFT */
+	uint64_t             bucket_mult;
+	/* Samples from here on take the slow path */
+	cycles_t             bucket_limit;
+	cycles_t             bias_cycles;
+	/* Trace threshold in cycles, UINT64_MAX if disabled */
+	cycles_t             threshold_cycles;
+	/* Log threshold in cycles, UINT64_MAX if disabled */
+	cycles_t             log_cycles;
+	/* Samples from here on need a look by record_event() */
+	cycles_t             event_cycles;
+	/* Min-heap of the g.top_n largest interruptions */
+	struct interruption  *top;
+	unsigned int         n_top;
+	/*
+	 * --pmc: hardware counters of this thread, read with rdpmc through
+	 * their perf mmap pages in every loop, and the SMI count of the msr
+	 * PMU, read with read() when an interruption is recorded.
+	 */
+	int                  pmc_fd[PMC_NUM];
+	struct perf_event_mmap_page *pmc_page[PMC_NUM];
+	uint64_t             pmc_prev[PMC_NUM];
+	uint64_t             pmc_cur[PMC_NUM];
+	int                  smi_fd;
+	uint64_t             smi_prev;
+	/* Time ordered log of interruptions above the log threshold */
+	struct interruption  *log;
+	unsigned int         n_log;
+	uint64_t             log_dropped;
+	/* Clocks read next to frc_start, to map counter values to time */
+	struct timespec      mono_start;
+	struct timespec      real_start;
+	pid_t                tid;
+	/* Noise by source, and by source and description */
+	struct noise_stat    noise[NR_NOISE_SOURCES];
+	struct noise_stat    *noise_desc;
+	unsigned int         n_noise_desc;
+	uint64_t             noise_lost;
 	/*
 	 * The extra part of the interruptions that cannot be put into even the
 	 * biggest bucket.  We'll use this to calculate a more accurate average at
@@ -170,12 +319,30 @@ struct thread {
 	uint64_t             overflow_sum;
 	int                  memory_allocated;
 
+	/*
+	 * Streaming mode: the main thread sets flush, the measuring thread
+	 * then swaps in the spare buckets, leaves the finished window in win
+	 * and clears flush.  The main thread zeroes win.buckets, i.e. the
+	 * new spare, before it asks for the next flush, so the measuring
+	 * thread never waits for anyone.
+	 */
+	volatile int         flush;
+	stamp_t              *spare_buckets;
+	stamp_t              win_start;
+	struct window        win;
+	/* Sum of all windows, main thread only */
+	struct window        total;
+
 	/* Buffers used for the workloads */
 	char                 *src_buf;
 	char                 *dst_buf;
 
 	/* These variables are calculated after the test */
 	double               average;
+	/* Average time of one measurement loop, i.e. the detection floor */
+	double               loop_period;
+	/* How much earlier than the last thread this one started, in ns */
+	double               start_skew;
 };
 
 struct global {
@@ -197,6 +364,8 @@ struct global {
 	int                   unit_per_us;
 	int                   precision;
 	int                   trace_threshold;
+	unsigned int          top_n;
+	int                   log_threshold;
 	int                   runtime;
 	/* The core that we run the main thread.  Default is cpu0 */
 	int                   cpu_main_thread;
@@ -209,13 +378,30 @@ struct global {
 	int                   quiet;
 	int                   single_preheat_thread;
 	int                   output_omit_zero_buckets;
+	int                   isolate;
+	int                   steer_irqs;
+	int                   noise_sources;
+	int                   pmc;
+	int                   stream_interval;
+	FILE                  *stream_file;
+	bool                  runtime_param;
+	struct cpu_config     *cpu_configs;
+	int                   n_cpu_configs;
 	char                  jsonfile[MAX_PATH];
 
+	/* Counter frequency in Hz, the same on all CPUs */
+	uint64_t              counter_hz;
+
 	/* Mutable state. */
 	volatile enum command cmd;
 	volatile unsigned int n_threads_started;
-	volatile unsigned int n_threads_running;
 	volatile unsigned int n_threads_finished;
+
+	/* Start barrier, see start_barrier() */
+	struct start_slot     *start_slots;
+	unsigned int          start_gen;
+	volatile unsigned int start_release;
+	volatile stamp_t      start_stamp;
 };
 
 static struct global g;
@@ -230,9 +416,91 @@ static void workload_memmove(char *dst, char *src, size_t size)
 	memmove(dst, src, size);
 }
 
+/*
+ * Link the cache lines of src into one random cycle (Sattolo's shuffle),
+ * so the hardware prefetchers can't guess the next line.  The current
+ * position is kept at the start of dst.
+ */
+static void workload_chase_init(char *dst, char *src, size_t size)
+{
+	size_t i, j, n = size / CACHE_LINE;
+	uint64_t x = (uintptr_t)src | 1;
+	size_t *order, tmp;
+
+	if (n < 2)
+		fatal("oslat: workload memory too small for the chase workload\n");
+	order = malloc(n * sizeof(order[0]));
+	if (!order)
+		fatal("oslat: could not allocate the chase order\n");
+	for (i = 0; i < n; i++)
+		order[i] = i;
+	for (i = n - 1; i > 0; i--) {
+		/* xorshift64 */
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		j = x % i;
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for (i = 0; i < n; i++)
+		*(char **)(src + order[i] * CACHE_LINE) =
+			src + order[(i + 1) % n] * CACHE_LINE;
+	*(char **)dst = src;
+	free(order);
+}
+
+static void workload_chase(char *dst, char *src, size_t size)
+{
+	char *p = *(char **)dst;
+	int i;
+
+	for (i = 0; i < CHASE_HOPS; i++)
+		p = *(char **)p;
+	*(char **)dst = p;
+}
+
+typedef float vfloat __attribute__((vector_size(64)));
+
+/*
+ * Wide FMA stream over the buffers.  On x86 the widest unit the CPU has is
+ * picked at load time, to see what the AVX2/AVX-512 frequency licenses do
+ * to the noise; elsewhere the compiler uses NEON/LSX/RVV when enabled.
+ */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__)
+__attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+static void workload_simd(char *dst, char *src, size_t size)
+{
+	vfloat *d = (vfloat *)dst, *s = (vfloat *)src;
+	size_t i, n = size / sizeof(vfloat);
+
+	for (i = 0; i < n; i++)
+		d[i] = d[i] * 0.5f + s[i];
+}
+
+/* Shared by all the measuring threads, so the line bounces between them */
+static uint64_t atomic_line __attribute__((aligned(CACHE_LINE)));
+
+static void workload_atomic(char *dst, char *src, size_t size)
+{
+	__atomic_fetch_add(&atomic_line, 1, __ATOMIC_SEQ_CST);
+}
+
+static void workload_syscall(char *dst, char *src, size_t size)
+{
+	syscall(SYS_getppid);
+}
+
 struct workload workload_list[WORKLOAD_NUM] = {
-	{ "no", 0, workload_nop },
-	{ "memmove", WORK_NEED_MEM, workload_memmove },
+	[WORKLOAD_NONE]    = { "no", 0, NULL, workload_nop },
+	[WORKLOAD_MEMMOVE] = { "memmove", WORK_NEED_MEM, NULL, workload_memmove },
+	[WORKLOAD_CHASE]   = { "chase", WORK_NEED_MEM, workload_chase_init,
+			       workload_chase },
+	[WORKLOAD_SIMD]    = { "simd", WORK_NEED_MEM, NULL, workload_simd },
+	[WORKLOAD_ATOMIC]  = { "atomic", 0, NULL, workload_atomic },
+	[WORKLOAD_SYSCALL] = { "getppid", 0, NULL, workload_syscall },
 };
 
 #define TEST(x)						\
@@ -262,44 +530,105 @@ static int move_to_core(int core_i)
 	return sched_setaffinity(0, sizeof(cpus), &cpus);
 }
 
-#ifndef arch_measure_counter_mhz
-static cycles_t __measure_counter_hz(void)
+/* a * b / c, exact and without overflow as long as b * c fits 64 bits */
+static inline uint64_t mul_div(uint64_t a, uint64_t b, uint64_t c)
 {
-	struct timeval tvs, tve;
-	stamp_t s, e;
-	double sec;
+	return a / c * b + a % c * b / c;
+}
 
-	frc(&s);
-	e = s;
-	gettimeofday(&tvs, NULL);
-	while (e - s < 1000000)
-		frc(&e);
-	gettimeofday(&tve, NULL);
-	sec = tve.tv_sec - tvs.tv_sec + (tve.tv_usec - tvs.tv_usec) / 1e6;
-	return (cycles_t) ((e - s) / sec);
+static uint64_t gcd(uint64_t a, uint64_t b)
+{
+	uint64_t r;
+
+	while (b) {
+		r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
 }
 
-static unsigned int measure_counter_mhz(void)
+/* The user visible unit is 1/g.unit_per_us us, i.e. us or ns */
+static uint64_t cycles_to_units(const struct thread *t, uint64_t cycles)
 {
-	cycles_t m, mprev, d;
+	return mul_div(cycles, g.unit_per_us * 1000000ULL, t->counter_hz);
+}
 
-	mprev = __measure_counter_hz();
-	do {
-		m = __measure_counter_hz();
-		if (m > mprev)
-			d = m - mprev;
-		else
-			d = mprev - m;
-		mprev = m;
-	} while (d > m / 1000);
+static uint64_t units_to_cycles(const struct thread *t, uint64_t units)
+{
+	return mul_div(units, t->counter_hz, g.unit_per_us * 1000000ULL);
+}
 
-	return (unsigned int) (m / 1000000);
+/* Lowest sample value record_event() has to see */
+static void update_event_cycles(struct thread *t)
+{
+	cycles_t ev = t->threshold_cycles;
+
+	if (t->log_cycles < ev)
+		ev = t->log_cycles;
+	if (g.top_n && !g.preheat) {
+		if (t->n_top < g.top_n)
+			ev = 0;
+		else if (t->top[0].duration + 1 < ev)
+			ev = t->top[0].duration + 1;
+	}
+	t->event_cycles = ev;
 }
-#endif
 
 static void thread_init(struct thread *t)
 {
-	t->counter_mhz = measure_counter_mhz();
+	uint64_t num, div, rem, err, exact, d;
+	int i;
+
+	t->counter_hz = g.counter_hz;
+	/*
+	 * The bucket is value * num / div, reduced so the error of the fixed
+	 * point factor stays small. The factor is rounded up, so value *
+	 * bucket_mult only exceeds the exact quotient by value * err /
+	 * (div << BUCKET_SHIFT). That never reaches the next bucket while
+	 * value * err < 1 << BUCKET_SHIFT, larger samples take the division
+	 * in bucket_overflow().
+	 */
+	num = g.unit_per_us * 1000000ULL;
+	div = t->counter_hz * g.bucket_width;
+	d = gcd(num, div);
+	num /= d;
+	div /= d;
+	t->bucket_mult = num / div;
+	rem = num % div;
+	for (i = 0; i < BUCKET_SHIFT; i++) {
+		t->bucket_mult <<= 1;
+		rem <<= 1;
+		if (rem >= div) {
+			rem -= div;
+			t->bucket_mult |= 1;
+		}
+	}
+	err = 0;
+	if (rem) {
+		t->bucket_mult++;
+		err = div - rem;
+	}
+	t->bucket_limit = units_to_cycles(t, (uint64_t)g.bucket_size *
+					  g.bucket_width);
+	if (err) {
+		exact = ((1ULL << BUCKET_SHIFT) + err - 1) / err;
+		if (exact < t->bucket_limit)
+			t->bucket_limit = exact;
+	}
+	/* g.bias will be set after pre-heat if user enabled it */
+	t->bias_cycles = units_to_cycles(t, g.bias);
+	t->threshold_cycles = UINT64_MAX;
+	t->log_cycles = UINT64_MAX;
+	if (!g.preheat && g.trace_threshold)
+		t->threshold_cycles = mul_div(g.trace_threshold, t->counter_hz,
+					      1000000);
+	if (!g.preheat && g.log_threshold)
+		t->log_cycles = mul_div(g.log_threshold, t->counter_hz, 1000000);
+	t->n_top = 0;
+	t->n_log = 0;
+	t->log_dropped = 0;
+	update_event_cycles(t);
 	t->maxlat = 0;
 	t->overflow_sum = 0;
 	t->minlat = (uint64_t)-1;
@@ -307,13 +636,25 @@ static void thread_init(struct thread *t)
 	/* NOTE: all the buffers are not freed until the process quits. */
 	if (!t->memory_allocated) {
 		TEST(t->buckets = calloc(1, sizeof(t->buckets[0]) * g.bucket_size));
-		if (g.workload->w_flags & WORK_NEED_MEM) {
-			TEST0(posix_memalign((void **)&t->src_buf, getpagesize(),
-					     g.workload_mem_size));
-			memset(t->src_buf, 0, g.workload_mem_size);
-			TEST0(posix_memalign((void **)&t->dst_buf, getpagesize(),
-					     g.workload_mem_size));
-			memset(t->dst_buf, 0, g.workload_mem_size);
+		if (g.top_n)
+			TEST(t->top = calloc(g.top_n, sizeof(t->top[0])));
+		if (g.log_threshold)
+			TEST(t->log = calloc(EVENT_LOG_SIZE, sizeof(t->log[0])));
+		if (g.stream_interval) {
+			TEST(t->spare_buckets = calloc(g.bucket_size,
+						       sizeof(t->buckets[0])));
+			TEST(t->total.buckets = calloc(g.bucket_size,
+						       sizeof(t->buckets[0])));
+		}
+		if (t->workload->w_flags & WORK_NEED_MEM) {
+			/* we run on our core already, so this is node local */
+			TEST(t->src_buf = numa_alloc_local(t->workload_mem_size));
+			memset(t->src_buf, 0, t->workload_mem_size);
+			TEST(t->dst_buf = numa_alloc_local(t->workload_mem_size));
+			memset(t->dst_buf, 0, t->workload_mem_size);
+			if (t->workload->w_init)
+				t->workload->w_init(t->dst_buf, t->src_buf,
+						    t->workload_mem_size);
 		}
 		t->memory_allocated = 1;
 	} else {
@@ -324,63 +665,160 @@ static void thread_init(struct thread *t)
 
 static float cycles_to_sec(const struct thread *t, uint64_t cycles)
 {
-	return cycles / (t->counter_mhz * 1e6);
+	return (double)cycles / t->counter_hz;
+}
+
+static void __attribute__((noinline, noreturn))
+trace_threshold_hit(struct thread *t, stamp_t value)
+{
+	char *line = "%s: Trace threshold (%d us) triggered on cpu %d with %.*f us!\n";
+	double us = (double)value * 1e6 / t->counter_hz;
+
+	tracemark(line, g.app_name, g.trace_threshold, t->core_i,
+		  g.precision, us);
+	err_quit(line, g.app_name, g.trace_threshold, t->core_i,
+		 g.precision, us);
 }
 
-static void insert_bucket(struct thread *t, stamp_t value)
+/* Exact bucket for samples at the end of the range or beyond */
+static uint64_t __attribute__((noinline))
+bucket_overflow(struct thread *t, stamp_t value)
 {
-	int index;
-	unsigned int lat;
-	uint64_t extra;
-	double us;
+	uint64_t index, extra;
 
-	lat = (value * g.unit_per_us) / t->counter_mhz;
-	us = (double)lat / g.unit_per_us;
-	if (!g.preheat && g.trace_threshold && us >= g.trace_threshold) {
-		char *line = "%s: Trace threshold (%d us) triggered on cpu %d with %.*f us!\n";
-		tracemark(line, g.app_name, g.trace_threshold, t->core_i,
-			  g.precision, us);
-		err_quit(line, g.app_name, g.trace_threshold, t->core_i,
-			 g.precision, us);
+	index = cycles_to_units(t, value) / g.bucket_width;
+	if (index < g.bucket_size)
+		return index;
+
+	/* Too big the jitter; keep the extra bit (in bucket width multiples) */
+	extra = index - g.bucket_size;
+	if (t->overflow_sum + extra < t->overflow_sum) {
+		/* The uint64_t even overflowed itself; bail out */
+		printf("Accumulated overflow too much!\n");
+		exit(1);
 	}
+	t->overflow_sum += extra;
 
-	/* Update max latency */
-	if (lat > t->maxlat)
-		t->maxlat = lat;
+	return g.bucket_size - 1;
+}
 
-	if (lat < t->minlat)
-		t->minlat = lat;
+static void top_sift_down(struct interruption *heap, unsigned int n,
+			  unsigned int i)
+{
+	struct interruption tmp;
+	unsigned int c;
 
-	if (g.bias) {
-		/* t->bias will be set after pre-heat if user enabled it */
-		lat -= g.bias;
-		/*
-		 * Negative should hardly happen, but if it happens, we assume we're in
-		 * the smallest bucket.
-		 */
-		if (lat <= 0)
-			lat = 1;
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n && heap[c + 1].duration < heap[c].duration)
+			c++;
+		if (heap[i].duration <= heap[c].duration)
+			break;
+		tmp = heap[i];
+		heap[i] = heap[c];
+		heap[c] = tmp;
+		i = c;
 	}
+}
 
-	index = lat / g.bucket_width;
-	assert(index >= 0);
+static bool top_wants(struct thread *t, stamp_t value)
+{
+	return t->n_top < g.top_n || value > t->top[0].duration;
+}
 
-	/* Too big the jitter; put into the last bucket */
-	if (index >= g.bucket_size) {
-		/* Keep the extra bit (in bucket width multiples) */
-		extra = index - g.bucket_size;
-		if (t->overflow_sum + extra < t->overflow_sum) {
-			/* The uint64_t even overflowed itself; bail out */
-			printf("Accumulated overflow too much!\n");
-			exit(1);
-		}
-		t->overflow_sum += extra;
-		index = g.bucket_size - 1;
+static void top_insert(struct thread *t, struct interruption *e)
+{
+	struct interruption *heap = t->top, tmp;
+	unsigned int i, p;
+
+	if (t->n_top == g.top_n) {
+		/* replace the smallest of the top N */
+		heap[0] = *e;
+		top_sift_down(heap, t->n_top, 0);
+		return;
+	}
+
+	i = t->n_top++;
+	heap[i] = *e;
+	while (i && heap[(p = (i - 1) / 2)].duration > heap[i].duration) {
+		tmp = heap[i];
+		heap[i] = heap[p];
+		heap[p] = tmp;
+		i = p;
+	}
+}
+
+static void pmc_fill(struct thread *t, struct interruption *e)
+{
+	uint64_t smi;
+	int i;
+
+	for (i = 0; i < PMC_NUM; i++)
+		e->pmc[i] = t->pmc_cur[i] - t->pmc_prev[i];
+
+	e->smi = -1;
+	if (t->smi_fd >= 0 && read(t->smi_fd, &smi, sizeof(smi)) == sizeof(smi)) {
+		e->smi = smi - t->smi_prev;
+		t->smi_prev = smi;
+	}
+}
+
+static void __attribute__((noinline))
+record_event(struct thread *t, stamp_t start, stamp_t value)
+{
+	struct interruption e = { .start = start, .duration = value };
+	bool log, top;
+
+	if (value >= t->threshold_cycles)
+		trace_threshold_hit(t, value);
+
+	log = value >= t->log_cycles;
+	top = g.top_n && !g.preheat && top_wants(t, value);
+
+	if (t->pmc_page[0] && (log || top))
+		pmc_fill(t, &e);
+
+	if (log) {
+		if (t->n_log < EVENT_LOG_SIZE)
+			t->log[t->n_log++] = e;
+		else
+			t->log_dropped++;
 	}
 
+	if (top)
+		top_insert(t, &e);
+
+	update_event_cycles(t);
+}
+
+static inline void insert_bucket(struct thread *t, stamp_t start,
+				 stamp_t value)
+{
+	uint64_t index;
+
+	if (value >= t->event_cycles)
+		record_event(t, start, value);
+
+	/* Update max latency */
+	if (value > t->maxlat)
+		t->maxlat = value;
+
+	if (value < t->minlat)
+		t->minlat = value;
+
+	/*
+	 * Samples below the bias should hardly happen, but if they do, we
+	 * assume we're in the smallest bucket.
+	 */
+	value = value > t->bias_cycles ? value - t->bias_cycles : 0;
+
+	if (value < t->bucket_limit)
+		index = (value * t->bucket_mult) >> BUCKET_SHIFT;
+	else
+		index = bucket_overflow(t, value);
+
 	t->buckets[index]++;
 	if (t->buckets[index] == 0) {
-		printf("Bucket %d overflowed\n", index);
+		printf("Bucket %" PRIu64 " overflowed\n", index);
 		exit(1);
 	}
 }
@@ -388,17 +826,199 @@ static void insert_bucket(struct thread *t, stamp_t value)
 static void doit(struct thread *t)
 {
 	stamp_t ts1, ts2;
-	workload_fn workload_fn = g.workload->w_fn;
+	workload_fn workload_fn = t->workload->w_fn;
 
 	frc(&ts2);
 	do {
-		workload_fn(t->dst_buf, t->src_buf, g.workload_mem_size);
+		workload_fn(t->dst_buf, t->src_buf, t->workload_mem_size);
 		frc(&ts1);
-		insert_bucket(t, ts1 - ts2);
+		insert_bucket(t, ts2, ts1 - ts2);
 		ts2 = ts1;
 	} while (g.cmd == GO);
 }
 
+static void __attribute__((noinline))
+swap_window(struct thread *t, stamp_t now)
+{
+	t->win.buckets = t->buckets;
+	t->win.minlat = t->minlat;
+	t->win.maxlat = t->maxlat;
+	t->win.overflow_sum = t->overflow_sum;
+	t->win.start = t->win_start;
+	t->win.stop = now;
+
+	t->buckets = t->spare_buckets;
+	t->spare_buckets = t->win.buckets;
+	t->minlat = UINT64_MAX;
+	t->maxlat = 0;
+	t->overflow_sum = 0;
+	t->win_start = now;
+
+	__atomic_store_n(&t->flush, 0, __ATOMIC_RELEASE);
+}
+
+/* doit() with a window swap whenever the main thread asks for one */
+static void doit_stream(struct thread *t)
+{
+	stamp_t ts1, ts2;
+	workload_fn workload_fn = t->workload->w_fn;
+
+	frc(&ts2);
+	t->win_start = ts2;
+	do {
+		workload_fn(t->dst_buf, t->src_buf, t->workload_mem_size);
+		frc(&ts1);
+		insert_bucket(t, ts2, ts1 - ts2);
+		ts2 = ts1;
+		if (t->flush)
+			swap_window(t, ts1);
+	} while (g.cmd == GO);
+}
+
+#ifdef arch_rdpmc
+static inline uint64_t pmc_read(struct perf_event_mmap_page *pc)
+{
+	uint32_t seq, idx;
+	uint64_t count;
+	int64_t pmc;
+
+	do {
+		seq = pc->lock;
+		__asm__ __volatile__("" ::: "memory");
+		idx = pc->index;
+		count = pc->offset;
+		if (idx) {
+			pmc = arch_rdpmc(idx - 1);
+			/* sign extend from the width of the counter */
+			pmc <<= 64 - pc->pmc_width;
+			pmc >>= 64 - pc->pmc_width;
+			count += pmc;
+		}
+		__asm__ __volatile__("" ::: "memory");
+	} while (pc->lock != seq);
+
+	return count;
+}
+#else
+/* --pmc is refused without rdpmc, so no counter is ever mapped */
+static inline uint64_t pmc_read(struct perf_event_mmap_page *pc)
+{
+	return 0;
+}
+#endif
+
+/* doit() which reads the perf counters next to the time stamp counter */
+static void doit_pmc(struct thread *t)
+{
+	stamp_t ts1, ts2;
+	workload_fn workload_fn = t->workload->w_fn;
+	int i;
+
+	frc(&ts2);
+	for (i = 0; i < PMC_NUM; i++)
+		t->pmc_prev[i] = pmc_read(t->pmc_page[i]);
+	t->win_start = ts2;
+	do {
+		workload_fn(t->dst_buf, t->src_buf, t->workload_mem_size);
+		frc(&ts1);
+		for (i = 0; i < PMC_NUM; i++)
+			t->pmc_cur[i] = pmc_read(t->pmc_page[i]);
+		insert_bucket(t, ts2, ts1 - ts2);
+		ts2 = ts1;
+		for (i = 0; i < PMC_NUM; i++)
+			t->pmc_prev[i] = t->pmc_cur[i];
+		if (t->flush)
+			swap_window(t, ts1);
+	} while (g.cmd == GO);
+}
+
+static int perf_event_open(struct perf_event_attr *attr)
+{
+	/* this thread on whatever CPU it runs on */
+	return syscall(SYS_perf_event_open, attr, 0, -1, -1, 0);
+}
+
+/* The SMI counter of the x86 msr PMU, if there is one */
+static int smi_open(void)
+{
+	struct perf_event_attr attr;
+	unsigned int config;
+	int type, ret = -1;
+	FILE *f;
+
+	f = fopen("/sys/bus/event_source/devices/msr/type", "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%d", &type) != 1)
+		type = -1;
+	fclose(f);
+
+	f = fopen("/sys/bus/event_source/devices/msr/events/smi", "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "event=%x", &config) == 1 && type >= 0) {
+		memset(&attr, 0, sizeof(attr));
+		attr.type = type;
+		attr.size = sizeof(attr);
+		attr.config = config;
+		ret = perf_event_open(&attr);
+	}
+	fclose(f);
+
+	return ret;
+}
+
+static void pmc_open(struct thread *t)
+{
+	static const uint64_t config[PMC_NUM] = {
+		[PMC_CYCLES]		= PERF_COUNT_HW_CPU_CYCLES,
+		[PMC_INSTRUCTIONS]	= PERF_COUNT_HW_INSTRUCTIONS,
+		[PMC_REF_CYCLES]	= PERF_COUNT_HW_REF_CPU_CYCLES,
+	};
+	struct perf_event_attr attr;
+	int i;
+
+	for (i = 0; i < PMC_NUM; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = config[i];
+		/* stay on the PMU, an unscheduled event can't be read */
+		attr.pinned = 1;
+
+		t->pmc_fd[i] = perf_event_open(&attr);
+		if (t->pmc_fd[i] < 0)
+			fatal("oslat: could not open the %s counter on cpu %d: %s\n",
+			      pmc_names[i], t->core_i, strerror(errno));
+		t->pmc_page[i] = mmap(NULL, getpagesize(), PROT_READ,
+				      MAP_SHARED, t->pmc_fd[i], 0);
+		if (t->pmc_page[i] == MAP_FAILED)
+			fatal("oslat: could not map the %s counter: %s\n",
+			      pmc_names[i], strerror(errno));
+		if (!t->pmc_page[i]->cap_user_rdpmc || !t->pmc_page[i]->index)
+			fatal("oslat: rdpmc of the %s counter is not permitted on cpu %d\n",
+			      pmc_names[i], t->core_i);
+	}
+
+	t->smi_fd = smi_open();
+	if (t->smi_fd < 0 ||
+	    read(t->smi_fd, &t->smi_prev, sizeof(t->smi_prev)) != sizeof(t->smi_prev))
+		t->smi_prev = 0;
+}
+
+static void pmc_close(struct thread *t)
+{
+	int i;
+
+	for (i = 0; i < PMC_NUM; i++) {
+		munmap(t->pmc_page[i], getpagesize());
+		t->pmc_page[i] = NULL;
+		close(t->pmc_fd[i]);
+	}
+	if (t->smi_fd >= 0)
+		close(t->smi_fd);
+}
+
 static int set_fifo_prio(int prio)
 {
 	struct sched_param param;
@@ -408,6 +1028,41 @@ static int set_fifo_prio(int prio)
 	return sched_setscheduler(0, SCHED_FIFO, &param);
 }
 
+/*
+ * All threads arrive through a tree with START_FANIN children per node, so
+ * no cache line is written by more than one thread. The root then sets a
+ * start stamp a little in the future and releases everyone, and all
+ * threads start measuring once the counter passes that stamp. This needs
+ * the counters to be synchronized across CPUs, as they are with invariant
+ * TSCs and the arm64, LoongArch and RISC-V timers.
+ */
+static void start_barrier(struct thread *t)
+{
+	unsigned int c, i = t->index, gen = g.start_gen;
+	stamp_t now;
+
+	for (c = i * START_FANIN + 1;
+	     c <= i * START_FANIN + START_FANIN && c < g.n_threads; c++)
+		while (__atomic_load_n(&g.start_slots[c].gen,
+				       __ATOMIC_ACQUIRE) != gen)
+			relax();
+
+	if (i) {
+		__atomic_store_n(&g.start_slots[i].gen, gen, __ATOMIC_RELEASE);
+		while (__atomic_load_n(&g.start_release, __ATOMIC_ACQUIRE) != gen)
+			relax();
+	} else {
+		frc(&now);
+		g.start_stamp = now + mul_div(START_MARGIN_US, t->counter_hz,
+					      1000000);
+		__atomic_store_n(&g.start_release, gen, __ATOMIC_RELEASE);
+	}
+
+	do {
+		frc(&now);
+	} while (now < g.start_stamp);
+}
+
 static void *thread_main(void *arg)
 {
 	/* Important thing to note here is that once we start bashing the CPU, we
@@ -416,31 +1071,47 @@ static void *thread_main(void *arg)
 	 */
 	struct thread *t = arg;
 
+	/* the main thread stays on the housekeeping CPUs */
+	if (g.isolate && cgroup_isolate_thread(0))
+		fatal("oslat: could not move thread into the isolated partition\n");
+
 	/* Alloc memory in the thread itself after setting affinity to get the
 	 * best chance of getting numa-local memory.  Doesn't matter so much for
 	 * the "struct thread" since we expect that to stay cache resident.
 	 */
 	TEST(move_to_core(t->core_i) == 0);
-	if (g.rtprio)
-		TEST(set_fifo_prio(g.rtprio) == 0);
+	if (t->rtprio)
+		TEST(set_fifo_prio(t->rtprio) == 0);
 
 	/* Don't bash the cpu until all threads have got going. */
 	atomic_inc(&g.n_threads_started);
 	while (g.cmd == WAIT)
-		usleep(1000);
+		syscall(SYS_futex, &g.cmd, FUTEX_WAIT_PRIVATE, WAIT,
+			NULL, NULL, 0);
 
 	thread_init(t);
+	/* per thread events, so they have to come from the thread itself */
+	if (g.pmc && !g.preheat)
+		pmc_open(t);
 
 	/* Ensure we all start at the same time. */
-	atomic_inc(&g.n_threads_running);
-	while (g.n_threads_running != g.n_threads)
-		relax();
+	start_barrier(t);
 
+	t->tid = gettid();
+	clock_gettime(CLOCK_MONOTONIC, &t->mono_start);
+	clock_gettime(CLOCK_REALTIME, &t->real_start);
 	frc(&t->frc_start);
-	doit(t);
+	if (t->pmc_page[0])
+		doit_pmc(t);
+	else if (g.stream_interval && !g.preheat)
+		doit_stream(t);
+	else
+		doit(t);
 	frc(&t->frc_stop);
 
 	t->runtime = t->frc_stop - t->frc_start;
+	if (t->pmc_page[0])
+		pmc_close(t);
 
 	/* Wait for everyone to finish so we don't disturb them by exiting and
 	 * waking the main thread.
@@ -472,23 +1143,118 @@ static double bucket_to_lat(int bucket)
 	return (g.bias + (bucket + 1) * (double)g.bucket_width) / g.unit_per_us;
 }
 
-void calculate(struct thread *t)
+static double buckets_average(stamp_t *buckets, uint64_t overflow_sum,
+			      uint64_t *count)
 {
+	double sum = 0;
 	int j;
+
+	*count = 0;
+	for (j = 0; j < g.bucket_size; j++) {
+		sum += buckets[j] * bucket_to_lat(j);
+		*count += buckets[j];
+	}
+	/* Add the extra amount of huge spikes in */
+	sum += overflow_sum * g.bucket_width / (double)g.unit_per_us;
+
+	return sum / *count;
+}
+
+void calculate(struct thread *t)
+{
+	stamp_t last_start = 0;
 	unsigned int i;
-	double sum;
 	uint64_t count;
 
+	for (i = 0; i < g.n_threads; ++i)
+		if (t[i].frc_start > last_start)
+			last_start = t[i].frc_start;
+
 	for (i = 0; i < g.n_threads; ++i) {
-		/* Calculate average */
-		sum = count = 0;
-		for (j = 0; j < g.bucket_size; j++) {
-			sum += t[i].buckets[j] * bucket_to_lat(j);
-			count += t[i].buckets[j];
+		t[i].average = buckets_average(t[i].buckets, t[i].overflow_sum,
+					       &count);
+		t[i].loop_period = count ?
+			t[i].runtime * 1e9 / t[i].counter_hz / count : 0;
+		t[i].start_skew = (last_start - t[i].frc_start) * 1e9 /
+			t[i].counter_hz;
+	}
+}
+
+static uint64_t stamp_to_mono_ns(struct thread *t, stamp_t stamp)
+{
+	return t->mono_start.tv_sec * NSEC_PER_SEC + t->mono_start.tv_nsec +
+		mul_div(stamp - t->frc_start, NSEC_PER_SEC, t->counter_hz);
+}
+
+/* The measuring thread itself shows up as thread noise, skip it */
+static bool noise_is_own(struct thread *t, struct noise_event *ev)
+{
+	return ev->source == NOISE_THREAD && ev->id == t->tid;
+}
+
+static void noise_add(struct noise_stat *n, uint64_t duration)
+{
+	n->count++;
+	n->total += duration;
+	if (duration > n->max)
+		n->max = duration;
+}
+
+static int cmp_noise_total_desc(const void *a, const void *b)
+{
+	const struct noise_stat *x = a, *y = b;
+
+	if (x->total == y->total)
+		return 0;
+	return x->total < y->total ? 1 : -1;
+}
+
+/* Sum up the osnoise events recorded on each CPU during its real run */
+static void noise_account(struct thread *t)
+{
+	struct noise_event *ev;
+	struct noise_stat *d;
+	struct noise_cpu *nc;
+	uint64_t start, stop;
+	unsigned int i, j;
+	size_t k;
+
+	for (i = 0; i < g.n_threads; ++i) {
+		for (j = 0; j < NR_NOISE_SOURCES; j++)
+			t[i].noise[j].source = j;
+
+		nc = osnoise_cpu(t[i].core_i);
+		if (!nc)
+			continue;
+		t[i].noise_lost = nc->lost;
+		TEST(t[i].noise_desc = calloc(NOISE_DESC_SIZE,
+					      sizeof(t[i].noise_desc[0])));
+
+		start = stamp_to_mono_ns(&t[i], t[i].frc_start);
+		stop = stamp_to_mono_ns(&t[i], t[i].frc_stop);
+		for (k = osnoise_find(nc, start);
+		     k < nc->nr && nc->events[k].end <= stop; k++) {
+			ev = &nc->events[k];
+			if (noise_is_own(&t[i], ev))
+				continue;
+			noise_add(&t[i].noise[ev->source], ev->duration);
+
+			d = t[i].noise_desc;
+			for (j = 0; j < t[i].n_noise_desc; j++)
+				if (d[j].source == ev->source &&
+				    !strcmp(d[j].desc, ev->desc))
+					break;
+			if (j == NOISE_DESC_SIZE)
+				continue;
+			if (j == t[i].n_noise_desc) {
+				d[j].source = ev->source;
+				memcpy(d[j].desc, ev->desc, sizeof(d[j].desc));
+				t[i].n_noise_desc++;
+			}
+			noise_add(&d[j], ev->duration);
 		}
-		/* Add the extra amount of huge spikes in */
-		sum += t->overflow_sum * g.bucket_width;
-		t[i].average = sum / count;
+		qsort(t[i].noise_desc, t[i].n_noise_desc,
+		      sizeof(t[i].noise_desc[0]), cmp_noise_total_desc);
 	}
 }
 
@@ -501,7 +1267,11 @@ static void write_summary(struct thread *t)
 	calculate(t);
 
 	putfield("Core", t[i].core_i, "d", "");
-	putfield("Counter Freq", t[i].counter_mhz, "u", " (MHz)");
+	putfield("Counter Freq", t[i].counter_hz / 1e6, "g", " (MHz)");
+	if (g.n_cpu_configs) {
+		putfield("Workload", t[i].workload->w_name, "s", "");
+		putfield("Priority", t[i].rtprio, "d", "");
+	}
 
 	for (j = 0; j < g.bucket_size; j++) {
 		if (j < g.bucket_size-1 && g.output_omit_zero_buckets) {
@@ -526,15 +1296,160 @@ static void write_summary(struct thread *t)
 			 (j == g.bucket_size - 1) ? " (including overflows)" : "");
 	}
 
-	putfieldp("Minimum", t[i].minlat, " (us)");
+	putfieldp("Minimum", cycles_to_units(&t[i], t[i].minlat), " (us)");
 	putfield("Average", t[i].average, ".3lf", " (us)");
-	putfieldp("Maximum", t[i].maxlat, " (us)");
-	putfieldp("Max-Min", t[i].maxlat - t[i].minlat, " (us)");
+	putfieldp("Maximum", cycles_to_units(&t[i], t[i].maxlat), " (us)");
+	putfieldp("Max-Min", cycles_to_units(&t[i], t[i].maxlat - t[i].minlat),
+		  " (us)");
 	putfield("Duration", cycles_to_sec(&(t[i]), t[i].runtime),
 		 ".3f", " (sec)");
+	putfield("Loop Period", t[i].loop_period, ".1lf", " (ns)");
+	putfield("Start Skew", t[i].start_skew, ".1lf", " (ns)");
+
+	if (g.noise_sources) {
+		for (j = 0; j < NR_NOISE_SOURCES; j++) {
+			snprintf(bucket_name, sizeof(bucket_name), "%s count",
+				 noise_source_names[j]);
+			putfield(bucket_name, t[i].noise[j].count, PRIu64, "");
+			snprintf(bucket_name, sizeof(bucket_name), "%s total",
+				 noise_source_names[j]);
+			putfield(bucket_name, t[i].noise[j].total / 1000.0,
+				 ".3f", " (us)");
+			snprintf(bucket_name, sizeof(bucket_name), "%s max",
+				 noise_source_names[j]);
+			putfield(bucket_name, t[i].noise[j].max / 1000.0,
+				 ".3f", " (us)");
+		}
+		putfield("Noise Lost", t[i].noise_lost, PRIu64, "");
+	}
 	printf("\n");
 }
 
+static void ts_add_ns(struct timespec *ts, uint64_t ns)
+{
+	ts->tv_sec += ns / NSEC_PER_SEC;
+	ts->tv_nsec += ns % NSEC_PER_SEC;
+	tsnorm(ts);
+}
+
+/* List the osnoise events overlapping with an interruption */
+static void write_gap_noise_json(FILE *f, struct thread *t,
+				 struct interruption *e)
+{
+	struct noise_cpu *nc = osnoise_cpu(t->core_i);
+	uint64_t start, stop;
+	struct noise_event *ev;
+	int comma = 0;
+	size_t k;
+
+	start = stamp_to_mono_ns(t, e->start);
+	stop = stamp_to_mono_ns(t, e->start + e->duration) + NOISE_SLACK_NS;
+
+	fprintf(f, ", \"noise\": [");
+	/* The noise is over by the time the measuring thread runs again */
+	for (k = nc ? osnoise_find(nc, start) : 0;
+	     nc && k < nc->nr && nc->events[k].end <= stop; k++) {
+		ev = &nc->events[k];
+		if (noise_is_own(t, ev))
+			continue;
+		fprintf(f, "%s{ \"source\": \"%s\", \"desc\": \"%s\", "
+			"\"id\": %d, \"duration\": %.3f }", comma ? ", " : " ",
+			noise_source_names[ev->source], ev->desc, ev->id,
+			ev->duration / 1000.0);
+		comma = 1;
+	}
+	fprintf(f, "%s]", comma ? " " : "");
+}
+
+static void write_interruption_json(FILE *f, struct thread *t,
+				    struct interruption *e, bool last)
+{
+	struct timespec mono = t->mono_start, real = t->real_start;
+	uint64_t ns = mul_div(e->start - t->frc_start, NSEC_PER_SEC,
+			      t->counter_hz);
+	int i;
+
+	ts_add_ns(&mono, ns);
+	ts_add_ns(&real, ns);
+	fprintf(f, "        { \"stamp\": %" PRIu64 ", "
+		"\"monotonic\": %ld.%09ld, \"realtime\": %ld.%09ld, "
+		"\"duration\": %.3f",
+		e->start, mono.tv_sec, mono.tv_nsec, real.tv_sec, real.tv_nsec,
+		(double)e->duration * 1e6 / t->counter_hz);
+	if (g.pmc) {
+		fprintf(f, ", \"pmc\": {");
+		for (i = 0; i < PMC_NUM; i++)
+			fprintf(f, " \"%s\": %" PRIu64 ",", pmc_names[i], e->pmc[i]);
+		fprintf(f, " \"smi\": %" PRId64 " }", e->smi);
+	}
+	if (g.noise_sources)
+		write_gap_noise_json(f, t, e);
+	fprintf(f, " }%s\n", last ? "" : ",");
+}
+
+static int cmp_duration_desc(const void *a, const void *b)
+{
+	const struct interruption *x = a, *y = b;
+
+	if (x->duration == y->duration)
+		return 0;
+	return x->duration < y->duration ? 1 : -1;
+}
+
+static void write_top_json(FILE *f, struct thread *t)
+{
+	unsigned int i;
+
+	/* The heap is done with, sort it largest first in place */
+	qsort(t->top, t->n_top, sizeof(t->top[0]), cmp_duration_desc);
+
+	fprintf(f, "      \"top\": [\n");
+	for (i = 0; i < t->n_top; i++)
+		write_interruption_json(f, t, &t->top[i], i == t->n_top - 1);
+	fprintf(f, "      ],\n");
+}
+
+static void write_log_json(FILE *f, struct thread *t)
+{
+	unsigned int i;
+
+	fprintf(f, "      \"log_threshold\": %d,\n", g.log_threshold);
+	fprintf(f, "      \"log_dropped\": %" PRIu64 ",\n", t->log_dropped);
+	fprintf(f, "      \"log\": [\n");
+	for (i = 0; i < t->n_log; i++)
+		write_interruption_json(f, t, &t->log[i], i == t->n_log - 1);
+	fprintf(f, "      ],\n");
+}
+
+static void write_noise_stat_json(FILE *f, struct noise_stat *n)
+{
+	fprintf(f, "\"count\": %" PRIu64 ", \"total\": %.3f, \"max\": %.3f",
+		n->count, n->total / 1000.0, n->max / 1000.0);
+}
+
+static void write_noise_json(FILE *f, struct thread *t)
+{
+	unsigned int i;
+
+	fprintf(f, "      \"noise\": {\n");
+	fprintf(f, "        \"lost\": %" PRIu64 ",\n", t->noise_lost);
+	for (i = 0; i < NR_NOISE_SOURCES; i++) {
+		fprintf(f, "        \"%s\": { ", noise_source_names[i]);
+		write_noise_stat_json(f, &t->noise[i]);
+		fprintf(f, " },\n");
+	}
+	fprintf(f, "        \"sources\": [\n");
+	for (i = 0; i < t->n_noise_desc; i++) {
+		fprintf(f, "          { \"source\": \"%s\", \"desc\": \"%s\", ",
+			noise_source_names[t->noise_desc[i].source],
+			t->noise_desc[i].desc);
+		write_noise_stat_json(f, &t->noise_desc[i]);
+		fprintf(f, " }%s\n", i == t->n_noise_desc - 1 ? "" : ",");
+	}
+	fprintf(f, "        ]\n");
+	fprintf(f, "      },\n");
+}
+
 static void write_summary_json(FILE *f, void *data)
 {
 	struct thread *t = data;
@@ -542,16 +1457,31 @@ static void write_summary_json(FILE *f, void *data)
 	unsigned long int i;
 
 	fprintf(f, "  \"num_threads\": %d,\n", g.n_threads);
+	fprintf(f, "  \"resolution_in_ns\": %d,\n", g.unit_per_us == 1000);
 	fprintf(f, "  \"thread\": {\n");
 	for (i = 0; i < g.n_threads; ++i) {
 		fprintf(f, "    \"%lu\": {\n", i);
 		fprintf(f, "      \"cpu\": %d,\n", t[i].core_i);
-		fprintf(f, "      \"freq\": %d,\n", t[i].counter_mhz);
-		fprintf(f, "      \"min\": %" PRIu64 ",\n", t[i].minlat);
-		fprintf(f, "      \"avg\": %3lf,\n", t[i].average);
-		fprintf(f, "      \"max\": %" PRIu64 ",\n", t[i].maxlat);
+		fprintf(f, "      \"freq\": %g,\n", t[i].counter_hz / 1e6);
+		fprintf(f, "      \"workload\": \"%s\",\n",
+			t[i].workload->w_name);
+		fprintf(f, "      \"rtprio\": %d,\n", t[i].rtprio);
+		fprintf(f, "      \"min\": %" PRIu64 ",\n",
+			cycles_to_units(&t[i], t[i].minlat));
+		/* in the same unit as min and max */
+		fprintf(f, "      \"avg\": %3lf,\n", t[i].average * g.unit_per_us);
+		fprintf(f, "      \"max\": %" PRIu64 ",\n",
+			cycles_to_units(&t[i], t[i].maxlat));
 		fprintf(f, "      \"duration\": %.3f,\n",
 			cycles_to_sec(&(t[i]), t[i].runtime));
+		fprintf(f, "      \"loop_period_ns\": %.1lf,\n", t[i].loop_period);
+		fprintf(f, "      \"start_skew_ns\": %.1lf,\n", t[i].start_skew);
+		if (g.top_n)
+			write_top_json(f, &t[i]);
+		if (g.log_threshold)
+			write_log_json(f, &t[i]);
+		if (g.noise_sources)
+			write_noise_json(f, &t[i]);
 		fprintf(f, "      \"histogram\": {");
 		for (j = 0, comma = 0; j < g.bucket_size; j++) {
 			if (t[i].buckets[j] == 0)
@@ -569,25 +1499,186 @@ static void write_summary_json(FILE *f, void *data)
 	fprintf(f, "  }\n");
 }
 
+static void window_merge(struct window *dst, struct window *src)
+{
+	int j;
+
+	for (j = 0; j < g.bucket_size; j++)
+		dst->buckets[j] += src->buckets[j];
+	if (src->minlat < dst->minlat)
+		dst->minlat = src->minlat;
+	if (src->maxlat > dst->maxlat)
+		dst->maxlat = src->maxlat;
+	dst->overflow_sum += src->overflow_sum;
+	if (src->start < dst->start)
+		dst->start = src->start;
+	if (src->stop > dst->stop)
+		dst->stop = src->stop;
+}
+
+static void write_window_json(FILE *f, struct thread *t, struct window *w,
+			      bool last)
+{
+	uint64_t count;
+	double avg;
+	int j, comma;
+
+	avg = buckets_average(w->buckets, w->overflow_sum, &count);
+	fprintf(f, "{\"cpu\": %d, \"samples\": %" PRIu64, t->core_i, count);
+	if (count)
+		fprintf(f, ", \"min\": %" PRIu64 ", \"avg\": %.3lf, "
+			"\"max\": %" PRIu64, cycles_to_units(t, w->minlat), avg,
+			cycles_to_units(t, w->maxlat));
+	fprintf(f, ", \"duration\": %.3f, \"histogram\": {",
+		cycles_to_sec(t, w->stop - w->start));
+	for (j = 0, comma = 0; j < g.bucket_size; j++) {
+		if (w->buckets[j] == 0)
+			continue;
+		fprintf(f, "%s\"%.*f\": %" PRIu64, comma ? ", " : "",
+			g.precision, bucket_to_lat(j), w->buckets[j]);
+		comma = 1;
+	}
+	fprintf(f, "}}%s", last ? "" : ", ");
+}
+
+/* One JSON line with the windows of all threads */
+static void write_windows(struct thread *t, struct window **w,
+			  unsigned long seq)
+{
+	FILE *f = g.stream_file;
+	struct timespec now;
+	unsigned int i;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	fprintf(f, "{\"window\": %lu, \"realtime\": %ld.%09ld, \"thread\": [",
+		seq, now.tv_sec, now.tv_nsec);
+	for (i = 0; i < g.n_threads; i++)
+		write_window_json(f, &t[i], w[i], i == g.n_threads - 1);
+	fprintf(f, "]}\n");
+	fflush(f);
+
+	for (i = 0; i < g.n_threads; i++) {
+		window_merge(&t[i].total, w[i]);
+		memset(w[i]->buckets, 0, g.bucket_size * sizeof(w[i]->buckets[0]));
+	}
+}
+
+/*
+ * Write a window every g.stream_interval seconds until the run is stopped,
+ * then the last partial one, and leave the sum of all windows in place of
+ * the usual per run results.
+ */
+static void stream_windows(struct thread *t)
+{
+	struct window **w, last;
+	struct timespec next;
+	unsigned long seq = 0;
+	bool stopped = false;
+	unsigned int i;
+
+	TEST(w = calloc(g.n_threads, sizeof(w[0])));
+	for (i = 0; i < g.n_threads; i++) {
+		t[i].total.minlat = UINT64_MAX;
+		t[i].total.maxlat = 0;
+		t[i].total.overflow_sum = 0;
+		t[i].total.start = UINT64_MAX;
+		t[i].total.stop = 0;
+		w[i] = &t[i].win;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	while (!stopped) {
+		next.tv_sec += g.stream_interval;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+				       NULL) == EINTR && g.cmd == GO)
+			;
+		if (g.cmd != GO)
+			break;
+
+		for (i = 0; i < g.n_threads; i++)
+			t[i].flush = 1;
+		for (i = 0; i < g.n_threads; i++) {
+			while (__atomic_load_n(&t[i].flush, __ATOMIC_ACQUIRE)) {
+				if (g.cmd != GO) {
+					stopped = true;
+					break;
+				}
+				usleep(100);
+			}
+		}
+		if (!stopped)
+			write_windows(t, w, seq++);
+	}
+
+	for (i = 0; i < g.n_threads; i++)
+		pthread_join(t[i].thread_id, NULL);
+
+	/* What is left: the active window, plus the last one if unread */
+	for (i = 0; i < g.n_threads; i++) {
+		last.buckets = t[i].buckets;
+		last.minlat = t[i].minlat;
+		last.maxlat = t[i].maxlat;
+		last.overflow_sum = t[i].overflow_sum;
+		last.start = t[i].win_start;
+		last.stop = t[i].frc_stop;
+		if (stopped && !t[i].flush)
+			window_merge(&last, &t[i].win);
+		t[i].win = last;
+		t[i].flush = 0;
+	}
+	write_windows(t, w, seq);
+
+	for (i = 0; i < g.n_threads; i++) {
+		t[i].spare_buckets = t[i].buckets;
+		t[i].buckets = t[i].total.buckets;
+		t[i].total.buckets = t[i].spare_buckets;
+		t[i].minlat = t[i].total.minlat;
+		t[i].maxlat = t[i].total.maxlat;
+		t[i].overflow_sum = t[i].total.overflow_sum;
+	}
+	free(w);
+}
+
 static void run_expt(struct thread *threads, int runtime_secs, bool preheat)
 {
+	bool stream = g.stream_interval && !preheat;
+	sigset_t sigs, oldsigs;
 	unsigned long int i;
 
 	g.runtime_secs = runtime_secs;
 	g.preheat = preheat;
 	g.n_threads_started = 0;
-	g.n_threads_running = 0;
 	g.n_threads_finished = 0;
+	g.start_gen++;
 	g.cmd = WAIT;
 
+	/* Streaming: signals go to the main thread, which sleeps meanwhile */
+	if (stream) {
+		sigemptyset(&sigs);
+		sigaddset(&sigs, SIGALRM);
+		sigaddset(&sigs, SIGINT);
+		sigaddset(&sigs, SIGTERM);
+		pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+	}
 	for (i = 0; i < g.n_threads; ++i)
 		TEST0(pthread_create(&(threads[i].thread_id), NULL,
 				     thread_main, &(threads[i])));
+	if (stream)
+		pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
 	while (g.n_threads_started != g.n_threads)
 		usleep(1000);
 
 	gettimeofday(&g.tv_start, NULL);
 	g.cmd = GO;
+	syscall(SYS_futex, &g.cmd, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+
+	if (stream) {
+		/* runs until stopped unless a duration was given */
+		if (g.runtime_param)
+			alarm(runtime_secs);
+		stream_windows(threads);
+		return;
+	}
 
 	alarm(runtime_secs);
 
@@ -612,10 +1703,26 @@ static void usage(int error)
 	       "-B, --bias             Add a bias to all the buckets using the estimated mininum\n"
 	       "-c, --cpu-list         Specify CPUs to run on, e.g. '1,3,5,7-15'\n"
 	       "-C, --cpu-main-thread  Specify which CPU the main thread runs on.  Default is cpu0.\n"
+	       "    --cpu-config=CPULIST:KEY=VAL[,KEY=VAL...]\n"
+	       "                       Override the workload (workload=), workload memory (mem=)\n"
+	       "                       or SCHED_FIFO priority (prio=, 0 for the default policy)\n"
+	       "                       of the threads on CPULIST, can be given multiple times\n"
 	       "-D, --duration         Specify test duration, e.g., 60, 20m, 2H\n"
 	       "                       (m/M: minutes, h/H: hours, d/D: days)\n"
 	       "    --json=FILENAME    write final results into FILENAME, JSON formatted\n"
+	       "    --log-threshold=US Log every interruption of at least US in the JSON output\n"
+	       "    --noise-sources    Break the noise down by source with the osnoise\n"
+	       "                       tracepoints (needs Linux 6.3+)\n"
+	       "    --pmc              Record the cycles, instructions, reference cycles and\n"
+	       "                       SMIs of each --top/--log-threshold interruption\n"
 	       "-f, --rtprio           Using SCHED_FIFO priority (1-99)\n"
+	       "    --isolate          Run on a cgroup v2 isolated partition made of the\n"
+	       "                       CPUs given with --cpu-list\n"
+	       "    --steer-irqs       Move all IRQs off the CPUs given with --cpu-list\n"
+	       "                       and restore their affinity on exit\n"
+	       "    --stream=TIME      Don't stop after --duration unless given, write the\n"
+	       "                       histograms of every TIME window as a JSON line\n"
+	       "    --stream-file=FILE Append the --stream lines to FILE instead of stdout\n"
 	       "-m, --workload-mem     Size of the memory to use for the workload (e.g., 4K, 1M).\n"
 	       "                       Total memory usage will be this value multiplies 2*N,\n"
 	       "                       because there will be src/dst buffers for each thread, and\n"
@@ -627,9 +1734,11 @@ static void usage(int error)
 	       "                       to lock the freq then please don't use this parameter.\n"
 	       "-T, --trace-threshold  Stop the test when threshold triggered (in us),\n"
 	       "                       print a marker in ftrace and stop ftrace too.\n"
+	       "    --top=N            Report the N largest interruptions of each thread\n"
+	       "                       in the JSON output\n"
 	       "-v, --version          Display the version of the software.\n"
 	       "-w, --workload         Specify a kind of workload, default is no workload\n"
-	       "                       (options: no, memmove)\n"
+	       "                       (options: no, memmove, chase, simd, atomic, getppid)\n"
 	       "-W, --bucket-width     Interval between buckets in nanoseconds\n"
 	       "                       NOTE: Widths not a multiple of 1000 cause ns-precision output\n"
 	       "                       You are responsible for considering the impact of measurement\n"
@@ -639,18 +1748,157 @@ static void usage(int error)
 	exit(error);
 }
 
-static int workload_select(char *name)
+static struct workload *workload_select(const char *name)
 {
 	int i = 0;
 
 	for (i = 0; i < WORKLOAD_NUM; i++) {
-		if (!strcmp(name, workload_list[i].w_name)) {
-			g.workload = &workload_list[i];
-			return 0;
+		if (!strcmp(name, workload_list[i].w_name))
+			return &workload_list[i];
+	}
+
+	printf("Unknown workload '%s'.  Please choose from: ", name);
+	for (i = 0; i < WORKLOAD_NUM; i++) {
+		printf("'%s'", workload_list[i].w_name);
+		if (i != WORKLOAD_NUM - 1)
+			printf(", ");
+	}
+	printf("\n\n");
+	exit(1);
+}
+
+/* CPULIST:key=value[,key=value...] with keys workload, mem and prio */
+static void parse_cpu_config(char *spec)
+{
+	struct cpu_config *c;
+	char *opts, *opt, *val, *save;
+
+	opts = strchr(spec, ':');
+	if (!opts) {
+		printf("Illegal cpu config '%s' (should be: CPULIST:key=value,...)\n",
+		       spec);
+		exit(1);
+	}
+	*opts++ = '\0';
+
+	TEST(g.cpu_configs = realloc(g.cpu_configs, (g.n_cpu_configs + 1) *
+				     sizeof(g.cpu_configs[0])));
+	c = &g.cpu_configs[g.n_cpu_configs++];
+	c->workload = NULL;
+	c->workload_mem_size = 0;
+	c->rtprio = -1;
+	c->cpus = numa_parse_cpustring_all(spec);
+	if (!c->cpus) {
+		printf("Illegal cpu list in cpu config: %s\n", spec);
+		exit(1);
+	}
+
+	for (opt = strtok_r(opts, ",", &save); opt;
+	     opt = strtok_r(NULL, ",", &save)) {
+		val = strchr(opt, '=');
+		if (!val)
+			goto illegal;
+		*val++ = '\0';
+
+		if (!strcmp(opt, "workload")) {
+			c->workload = workload_select(val);
+		} else if (!strcmp(opt, "mem")) {
+			if (parse_mem_string(val, &c->workload_mem_size) ||
+			    !c->workload_mem_size)
+				goto illegal;
+		} else if (!strcmp(opt, "prio")) {
+			c->rtprio = strtol(val, NULL, 10);
+			if (c->rtprio < 0 || c->rtprio > 99)
+				goto illegal;
+		} else {
+			goto illegal;
+		}
+	}
+	return;
+
+illegal:
+	printf("Illegal cpu config option '%s' for cpus %s\n", opt, spec);
+	exit(1);
+}
+
+/* Size of the last level cache of cpu in bytes, 0 if unknown */
+static uint64_t llc_size(int cpu)
+{
+	char path[128], buf[32];
+	uint64_t size = 0, val;
+	int i, level, max_level = 0;
+	char unit;
+	FILE *f;
+
+	for (i = 0; ; i++) {
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/cache/index%d/level",
+			 cpu, i);
+		f = fopen(path, "r");
+		if (!f)
+			break;
+		if (fscanf(f, "%d", &level) != 1)
+			level = 0;
+		fclose(f);
+		if (level < max_level)
+			continue;
+
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/cpu/cpu%d/cache/index%d/size",
+			 cpu, i);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (fgets(buf, sizeof(buf), f) &&
+		    sscanf(buf, "%" SCNu64 "%c", &val, &unit) >= 1) {
+			if (unit == 'K')
+				val <<= 10;
+			else if (unit == 'M')
+				val <<= 20;
+			max_level = level;
+			size = val;
 		}
+		fclose(f);
+	}
+
+	return size;
+}
+
+/* Workload memory of a thread on cpu if not given with -m */
+static uint64_t default_mem_size(struct workload *w, int cpu)
+{
+	uint64_t llc;
+
+	if (w != &workload_list[WORKLOAD_CHASE])
+		return WORKLOAD_MEM_SIZE;
+
+	llc = llc_size(cpu);
+	return llc ? llc * CHASE_LLC_FACTOR : CHASE_MEM_SIZE;
+}
+
+static void apply_cpu_configs(struct thread *t)
+{
+	struct cpu_config *c;
+	int i;
+
+	t->workload = g.workload;
+	t->workload_mem_size = g.workload_mem_size;
+	t->rtprio = g.rtprio;
+
+	for (i = 0; i < g.n_cpu_configs; i++) {
+		c = &g.cpu_configs[i];
+		if (!numa_bitmask_isbitset(c->cpus, t->core_i))
+			continue;
+		if (c->workload)
+			t->workload = c->workload;
+		if (c->workload_mem_size)
+			t->workload_mem_size = c->workload_mem_size;
+		if (c->rtprio >= 0)
+			t->rtprio = c->rtprio;
 	}
 
-	return -1;
+	if (!t->workload_mem_size)
+		t->workload_mem_size = default_mem_size(t->workload, t->core_i);
 }
 
 enum option_value {
@@ -658,7 +1906,8 @@ enum option_value {
 	OPT_DURATION, OPT_JSON, OPT_RT_PRIO, OPT_HELP, OPT_TRACE_TH,
 	OPT_WORKLOAD, OPT_WORKLOAD_MEM, OPT_BIAS,
 	OPT_QUIET, OPT_SINGLE_PREHEAT, OPT_ZERO_OMIT,
-	OPT_VERSION
+	OPT_VERSION, OPT_ISOLATE, OPT_STEER_IRQS, OPT_TOP, OPT_LOG_TH,
+	OPT_NOISE, OPT_CPU_CONFIG, OPT_STREAM, OPT_STREAM_FILE, OPT_PMC
 };
 
 /* Process commandline options */
@@ -671,10 +1920,19 @@ static void parse_options(int argc, char *argv[])
 			{ "bucket-width", required_argument,	NULL, OPT_BUCKETWIDTH },
 			{ "cpu-list",	required_argument,	NULL, OPT_CPU_LIST },
 			{ "cpu-main-thread", required_argument, NULL, OPT_CPU_MAIN_THREAD},
+			{ "cpu-config",	required_argument,	NULL, OPT_CPU_CONFIG },
 			{ "duration",	required_argument,	NULL, OPT_DURATION },
 			{ "json",	required_argument,      NULL, OPT_JSON },
 			{ "rtprio",	required_argument,	NULL, OPT_RT_PRIO },
 			{ "help",	no_argument,		NULL, OPT_HELP },
+			{ "isolate",	no_argument,		NULL, OPT_ISOLATE },
+			{ "steer-irqs",	no_argument,		NULL, OPT_STEER_IRQS },
+			{ "stream",	required_argument,	NULL, OPT_STREAM },
+			{ "stream-file", required_argument,	NULL, OPT_STREAM_FILE },
+			{ "top",	required_argument,	NULL, OPT_TOP },
+			{ "log-threshold", required_argument,	NULL, OPT_LOG_TH },
+			{ "noise-sources", no_argument,		NULL, OPT_NOISE },
+			{ "pmc",	no_argument,		NULL, OPT_PMC },
 			{ "trace-threshold", required_argument,	NULL, OPT_TRACE_TH },
 			{ "workload",	required_argument,	NULL, OPT_WORKLOAD },
 			{ "workload-mem", required_argument,	NULL, OPT_WORKLOAD_MEM },
@@ -685,7 +1943,7 @@ static void parse_options(int argc, char *argv[])
 			{ "version",	no_argument,		NULL, OPT_VERSION },
 			{ NULL, 0, NULL, 0 },
 		};
-		int i, c = getopt_long(argc, argv, "b:Bc:C:D:f:hm:qsw:W:T:vz",
+		int c = getopt_long(argc, argv, "b:Bc:C:D:f:hm:qsw:W:T:vz",
 				       options, &option_index);
 		long ncores;
 
@@ -742,6 +2000,7 @@ static void parse_options(int argc, char *argv[])
 				printf("Illegal runtime: %s\n", optarg);
 				exit(1);
 			}
+			g.runtime_param = true;
 			break;
 		case OPT_RT_PRIO:
 		case 'f':
@@ -751,6 +2010,54 @@ static void parse_options(int argc, char *argv[])
 				exit(1);
 			}
 			break;
+		case OPT_ISOLATE:
+			g.isolate = 1;
+			break;
+		case OPT_STEER_IRQS:
+			g.steer_irqs = 1;
+			break;
+		case OPT_TOP:
+			g.top_n = strtol(optarg, NULL, 10);
+			if ((int)g.top_n <= 0) {
+				printf("Parameter --top needs to be positive\n");
+				exit(1);
+			}
+			break;
+		case OPT_LOG_TH:
+			g.log_threshold = strtol(optarg, NULL, 10);
+			if (g.log_threshold <= 0) {
+				printf("Parameter --log-threshold needs to be positive\n");
+				exit(1);
+			}
+			break;
+		case OPT_STREAM:
+			g.stream_interval = parse_time_string(optarg);
+			if (g.stream_interval <= 0) {
+				printf("Illegal stream interval: %s\n", optarg);
+				exit(1);
+			}
+			break;
+		case OPT_STREAM_FILE:
+			g.stream_file = fopen(optarg, "a");
+			if (!g.stream_file) {
+				printf("Could not open %s: %s\n", optarg,
+				       strerror(errno));
+				exit(1);
+			}
+			break;
+		case OPT_CPU_CONFIG:
+			parse_cpu_config(optarg);
+			break;
+		case OPT_PMC:
+#ifndef arch_rdpmc
+			printf("--pmc is not supported on this architecture\n");
+			exit(1);
+#endif
+			g.pmc = 1;
+			break;
+		case OPT_NOISE:
+			g.noise_sources = 1;
+			break;
 		case OPT_JSON:
 			strncpy(g.jsonfile, optarg, strnlen(optarg, MAX_PATH-1));
 			break;
@@ -765,16 +2072,7 @@ static void parse_options(int argc, char *argv[])
 			break;
 		case OPT_WORKLOAD:
 		case 'w':
-			if (workload_select(optarg)) {
-				printf("Unknown workload '%s'.  Please choose from: ", optarg);
-				for (i = 0; i < WORKLOAD_NUM; i++) {
-					printf("'%s'", workload_list[i].w_name);
-					if (i != WORKLOAD_NUM - 1)
-						printf(", ");
-				}
-				printf("\n\n");
-				exit(1);
-			}
+			g.workload = workload_select(optarg);
 			break;
 		case OPT_WORKLOAD_MEM:
 		case 'm':
@@ -819,10 +2117,17 @@ static void parse_options(int argc, char *argv[])
 
 	if (!g.bucket_size_param && g.precision == 3 && g.bucket_width < 1000)
 		g.bucket_size = BUCKET_SIZE * 1000 / g.bucket_width;
+
+	if (g.pmc && !g.top_n && !g.log_threshold) {
+		printf("--pmc needs --top or --log-threshold\n");
+		exit(1);
+	}
 }
 
-void dump_globals(void)
+void dump_globals(struct thread *t)
 {
+	unsigned int i;
+
 	printf("Total runtime: \t\t%d seconds\n", g.runtime);
 	printf("Thread priority: \t");
 	if (g.rtprio)
@@ -834,9 +2139,20 @@ void dump_globals(void)
 	printf("Workload: \t\t%s\n", g.workload->w_name);
 	printf("Workload mem: \t\t%"PRIu64" (KiB)\n",
 	       (g.workload->w_flags & WORK_NEED_MEM) ?
-	       (g.workload_mem_size / 1024) : 0);
+	       ((g.workload_mem_size ?:
+		 default_mem_size(g.workload, t[0].core_i)) / 1024) : 0);
 	printf("Preheat cores: \t\t%d\n", g.single_preheat_thread ?
 	       1 : g.n_threads_total);
+	for (i = 0; g.n_cpu_configs && i < g.n_threads_total; i++) {
+		printf("CPU %d: \t\t%s, %"PRIu64" (KiB), ", t[i].core_i,
+		       t[i].workload->w_name,
+		       (t[i].workload->w_flags & WORK_NEED_MEM) ?
+		       (t[i].workload_mem_size / 1024) : 0);
+		if (t[i].rtprio)
+			printf("SCHED_FIFO:%d\n", t[i].rtprio);
+		else
+			printf("default\n");
+	}
 	printf("\n");
 }
 
@@ -850,8 +2166,8 @@ static void record_bias(struct thread *t)
 
 	/* Record the min value of minlat on all the threads */
 	for (i = 0; i < g.n_threads; ++i) {
-		if (t[i].minlat < bias)
-			bias = t[i].minlat;
+		if (cycles_to_units(&t[i], t[i].minlat) < bias)
+			bias = cycles_to_units(&t[i], t[i].minlat);
 	}
 	g.bias = bias;
 	printf("Global bias set to %.*f (us)\n", g.precision,
@@ -864,6 +2180,8 @@ int main(int argc, char *argv[])
 	int n_cores;
 	unsigned long int i;
 	struct bitmask *cpu_set = NULL;
+	cpu_set_t set;
+	char cpus[4096];
 
 #ifdef FRC_MISSING
 	printf("This architecture is not yet supported. "
@@ -884,33 +2202,73 @@ int main(int argc, char *argv[])
 	g.unit_per_us = 1;
 	g.runtime = 1;
 	g.workload = &workload_list[WORKLOAD_DEFAULT];
-	g.workload_mem_size = WORKLOAD_MEM_SIZE;
+	/* 0 picks the default of each thread's workload */
+	g.workload_mem_size = 0;
 	/* Run the main thread on cpu0 by default */
 	g.cpu_main_thread = 0;
 	printf("oslat V %1.2f\n", VERSION);
 	parse_options(argc, argv);
+	if (g.stream_interval && !g.stream_file)
+		g.stream_file = stdout;
 
 	TEST(mlockall(MCL_CURRENT | MCL_FUTURE) == 0);
 
 	if (!g.cpu_list)
 		g.cpu_list = strdup("all");
 
+#ifdef arch_check_counter
+	arch_check_counter();
+#endif
+	g.counter_hz = counter_hz(CALIBRATION_CACHE);
+
 	cpu_set = numa_parse_cpustring_all(g.cpu_list);
 	if (!cpu_set)
 		fatal("oslat: numa_parse_cpustring_all failed.\n");
 	n_cores = numa_bitmask_weight(cpu_set);
+	cpumask_to_cpuset(cpu_set, &set);
+	if (format_cpulist(&set, cpus, sizeof(cpus)) < 0)
+		fatal("oslat: cpu list %s is too long\n", g.cpu_list);
+
+	if (g.isolate) {
+		if (numa_bitmask_isbitset(cpu_set, g.cpu_main_thread))
+			fatal("oslat: cpu %d of the main thread is isolated, pick another one with -C\n",
+			      g.cpu_main_thread);
+		if (cgroup_isolate(cpus, CGROUP_ISOLATED))
+			fatal("oslat: could not isolate cpus %s\n", g.cpu_list);
+	}
+
+	if (g.steer_irqs && irq_steer_away(cpus) < 0)
+		fatal("oslat: could not steer IRQs away from cpus %s\n",
+		      g.cpu_list);
+
+	if (g.noise_sources) {
+		/* started early so the tracer has settled by the real run */
+		if (osnoise_start(cpus))
+			fatal("oslat: could not trace the noise on cpus %s\n",
+			      g.cpu_list);
+	}
 
 	TEST(threads = calloc(1, n_cores * sizeof(threads[0])));
+	TEST0(posix_memalign((void **)&g.start_slots, sizeof(g.start_slots[0]),
+			     n_cores * sizeof(g.start_slots[0])));
+	memset(g.start_slots, 0, n_cores * sizeof(g.start_slots[0]));
 	for (i = 0; n_cores && i < cpu_set->size; i++) {
-		if (numa_bitmask_isbitset(cpu_set, i) && move_to_core(i) == 0) {
-			threads[g.n_threads_total++].core_i = i;
+		/*
+		 * The main thread can't enter the partition, cgroup_isolate()
+		 * made sure all of its cpus are online
+		 */
+		if (numa_bitmask_isbitset(cpu_set, i) &&
+		    (g.isolate || move_to_core(i) == 0)) {
+			threads[g.n_threads_total].core_i = i;
+			threads[g.n_threads_total].index = g.n_threads_total;
+			apply_cpu_configs(&threads[g.n_threads_total]);
+			if (i == 0 && threads[g.n_threads_total].rtprio)
+				printf("WARNING: Running SCHED_FIFO workload on CPU 0 may hang the thread\n");
+			g.n_threads_total++;
 			n_cores--;
 		}
 	}
 
-	if (numa_bitmask_isbitset(cpu_set, 0) && g.rtprio)
-		printf("WARNING: Running SCHED_FIFO workload on CPU 0 may hang the thread\n");
-
 	numa_bitmask_free(cpu_set);
 
 	TEST(move_to_core(g.cpu_main_thread) == 0);
@@ -920,7 +2278,7 @@ int main(int argc, char *argv[])
 	signal(SIGTERM, handle_alarm);
 
 	if (!g.quiet)
-		dump_globals();
+		dump_globals(threads);
 
 	if (!g.quiet)
 		printf("Pre-heat for 1 seconds...\n");
@@ -937,6 +2295,11 @@ int main(int argc, char *argv[])
 	g.n_threads = g.n_threads_total;
 	run_expt(threads, g.runtime, false);
 
+	if (g.noise_sources) {
+		osnoise_stop();
+		noise_account(threads);
+	}
+
 	if (!g.quiet)
 		printf("Test completed.\n\n");
 
@@ -25,6 +25,8 @@
 #include "rt-utils.h"
 #include "rt-get_cpu.h"
 #include "rt-error.h"
+#include "rt-cgroup.h"
+#include "rt-irq.h"
 
 enum {
 	AFFINITY_UNSPECIFIED,
@@ -55,6 +57,8 @@ struct params {
 	struct params *neighbor;
 };
 
+static int isolate;
+
 void *semathread(void *param)
 {
 	int mustgetcpu = 0;
@@ -67,6 +71,10 @@ void *semathread(void *param)
 	schedp.sched_priority = par->priority;
 	sched_setscheduler(0, policy, &schedp);
 
+	/* the main thread stays on the housekeeping CPUs */
+	if (isolate && cgroup_isolate_thread(0))
+		fatal("Could not move thread into the isolated partition\n");
+
 	if (par->cpu != -1) {
 		CPU_ZERO(&mask);
 		CPU_SET(par->cpu, &mask);
@@ -149,12 +157,15 @@ static void display_help(int error)
 	       "                           Append 'm', 'h', or 'd' to specify minutes, hours or\n"
 	       "                           days.\n"
 	       "-i INTV  --interval=INTV   base interval of thread in us default=1000\n"
+	       "         --isolate         run on a cgroup v2 isolated partition made of\n"
+	       "                           the CPU given with -a NUM\n"
 	       "         --json=FILENAME   write final results into FILENAME, JSON formatted\n"
 	       "-l LOOPS --loops=LOOPS     number of loops: default=0(endless)\n"
 	       "-p PRIO  --prio=PRIO       priority\n"
 	       "-q       --quiet           print a summary only on exit\n"
 	       "-S       --smp             SMP testing: options -a -t and same priority\n"
 	       "                           of all threads\n"
+	       "         --steer-irqs      move all IRQs off the CPU given with -a NUM\n"
 	       "-t       --threads         one thread per available processor\n"
 	       "-t [NUM] --threads=NUM     number of threads:\n"
 	       "                           without NUM, threads = max_cpus\n"
@@ -166,6 +177,7 @@ static void display_help(int error)
 
 static int setaffinity = AFFINITY_UNSPECIFIED;
 static int affinity;
+static int steer_irqs;
 static int tracelimit;
 static int priority;
 static int num_threads = 1;
@@ -180,8 +192,8 @@ static char jsonfile[MAX_PATH];
 
 enum option_value {
 	OPT_AFFINITY=1, OPT_BREAKTRACE, OPT_DISTANCE, OPT_DURATION,
-	OPT_HELP, OPT_INTERVAL, OPT_JSON, OPT_LOOPS, OPT_PRIORITY,
-	OPT_QUIET, OPT_SMP, OPT_THREADS
+	OPT_HELP, OPT_INTERVAL, OPT_ISOLATE, OPT_JSON, OPT_LOOPS, OPT_PRIORITY,
+	OPT_QUIET, OPT_SMP, OPT_STEER_IRQS, OPT_THREADS
 };
 
 static void process_options(int argc, char *argv[])
@@ -199,11 +211,13 @@ static void process_options(int argc, char *argv[])
 			{"duration",	required_argument,	NULL, OPT_DURATION},
 			{"help",	no_argument,		NULL, OPT_HELP},
 			{"interval",	required_argument,	NULL, OPT_INTERVAL},
+			{"isolate",	no_argument,		NULL, OPT_ISOLATE},
 			{"json",	required_argument,      NULL, OPT_JSON },
 			{"loops",	required_argument,	NULL, OPT_LOOPS},
 			{"priority",	required_argument,	NULL, OPT_PRIORITY},
 			{"quiet",	no_argument	,	NULL, OPT_QUIET},
 			{"smp",		no_argument,		NULL, OPT_SMP},
+			{"steer-irqs",	no_argument,		NULL, OPT_STEER_IRQS},
 			{"threads",	optional_argument,	NULL, OPT_THREADS},
 			{NULL, 0, NULL, 0}
 		};
@@ -244,6 +258,12 @@ static void process_options(int argc, char *argv[])
 		case 'i':
 			interval = atoi(optarg);
 			break;
+		case OPT_ISOLATE:
+			isolate = 1;
+			break;
+		case OPT_STEER_IRQS:
+			steer_irqs = 1;
+			break;
 		case OPT_JSON:
 			strncpy(jsonfile, optarg, strnlen(optarg, MAX_PATH-1));
 			break;
@@ -314,6 +334,16 @@ static void process_options(int argc, char *argv[])
 	if (priority && smp)
 		sameprio = 1;
 
+	if (isolate && setaffinity != AFFINITY_SPECIFIED) {
+		fprintf(stderr, "ERROR: --isolate requires -a NUM\n");
+		error = 1;
+	}
+
+	if (steer_irqs && setaffinity != AFFINITY_SPECIFIED) {
+		fprintf(stderr, "ERROR: --steer-irqs requires -a NUM\n");
+		error = 1;
+	}
+
 	if (error)
 		display_help(error);
 }
@@ -401,6 +431,17 @@ int main(int argc, char *argv[])
 	if (check_privs())
 		return 1;
 
+	if (isolate || steer_irqs) {
+		char cpu[16];
+
+		snprintf(cpu, sizeof(cpu), "%d", affinity);
+		if (isolate && cgroup_isolate(cpu, CGROUP_ISOLATED))
+			fatal("Could not isolate CPU %d\n", affinity);
+		if (steer_irqs && irq_steer_away(cpu) < 0)
+			fatal("Could not steer IRQs away from CPU %d\n",
+			      affinity);
+	}
+
 	if (mlockall(MCL_CURRENT|MCL_FUTURE) == -1) {
 		perror("mlockall");
 		return 1;
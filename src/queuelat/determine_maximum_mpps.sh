@@ -4,11 +4,11 @@
 # Copyright (C) 2018 Marcelo Tosatti <mtosatti@redhat.com>
 
 #  A script to determine the maximum mpps. Logic:
-#  Increase mpps in 0.5 units 
-# 
+#  Let queuelat -s search the highest mpps without drops, then confirm
+#  it with a 10 minutes run, lowering it in 0.1 units on failure
+#
 MAXLAT="20000"
 CYCLES_PER_PACKET="300"
-OUTFILE=/usr/tmp/outfile
 PRIO=1
 CPULIST=0
 SCHED=""
@@ -40,19 +40,6 @@ usage()
 	exit
 }
 
-get_cpuinfo_mhz()
-{
-	# Try to determine MHz from /proc/cpuinfo
-	FREQ_MHZ=$(grep "cpu MHz" /proc/cpuinfo | cut -f 3 -d " " | sort -rn | head -n1)
-
-	# Try to determine MHz from /sys/firmware/devicetree/base/cpus/timebase-frequency
-	if [ -z $FREQ_MHZ ]; then
-		FREQ_MHZ=$(($((16#$(hexdump -e '1/1 "%02X"' /sys/firmware/devicetree/base/cpus/timebase-frequency)))/1000000))
-	fi
-
-	echo "$FREQ_MHZ"
-}
-
 # Check that the scheduling policy hasn't already been set
 # Exit with an error message if it has
 check_sched()
@@ -97,93 +84,18 @@ echo "Determining maximum mpps the machine can handle"
 echo "Will take a few minutes to determine mpps value"
 echo "And 10 minutes run to confirm the final mpps value is stable"
 
-for mpps in $(seq 3 3 50); do
-	echo testing "$mpps" Mpps
-
-	OUTFILE=$(mktemp)
-	$PREAMBLE queuelat -m $MAXLAT -c $CYCLES_PER_PACKET -f "$(get_cpuinfo_mhz)" -p "$mpps" -t 30 > "$OUTFILE"
-
-	exceeded=$(grep exceeded "$OUTFILE")
-	if [ ! -z "$exceeded" ]; then
-		echo mpps failed: "$mpps"
-		break;
-	fi
-	echo success
-done
-echo first loop mpps: "$mpps"
-
-first_mpps=$(($mpps - 1))
-for mpps in $(seq $first_mpps -1 3); do
-	echo testing "$mpps" Mpps
-
-	OUTFILE=$(mktemp)
-	$PREAMBLE queuelat -m $MAXLAT -c $CYCLES_PER_PACKET -f "$(get_cpuinfo_mhz)" -p "$mpps" -t 30 > "$OUTFILE"
-
-	exceeded=$(grep exceeded "$OUTFILE")
-	if [ -z "$exceeded" ]; then
-		echo mpps success "$mpps"
-		break;
-	fi
-	echo failure
-done
-
-second_mpps=$(echo "$mpps + 0.3" | bc)
-echo second loop mpps: "$mpps"
-
-for mpps in $(seq "$second_mpps" 0.3 $first_mpps); do
-	echo testing "$mpps" Mpps
-
-	OUTFILE=$(mktemp)
-	$PREAMBLE queuelat -m $MAXLAT -c $CYCLES_PER_PACKET -f "$(get_cpuinfo_mhz)" -p "$mpps" -t 30 > "$OUTFILE"
-
-	exceeded=$(grep exceeded "$OUTFILE")
-	if [ ! -z "$exceeded" ]; then
-		echo mpps failure "$mpps"
-		break;
-	fi
-	echo success
-done
-
-echo third loop mpps: "$mpps"
-third_mpps=$(echo "$mpps -0.1" | bc)
-
-for mpps in $(seq "$third_mpps" -0.1 3); do
-	echo testing "$mpps" Mpps
-
-	OUTFILE=$(mktemp)
-	$PREAMBLE queuelat -m $MAXLAT -c $CYCLES_PER_PACKET -f "$(get_cpuinfo_mhz)" -p "$mpps" -t 30 > "$OUTFILE"
-
-	exceeded=$(grep exceeded "$OUTFILE")
-	if [ -z "$exceeded" ]; then
-		echo mpps success "$mpps"
-		break;
-	fi
-	echo failure
-done
-
-export queuelat_failure=1
-while [ $queuelat_failure == 1 ]; do
-
-	export queuelat_failure=0
-
-	echo -n "Starting 10 runs of 30 seconds with "
-	echo "$mpps Mpps"
-
-	for i in $(seq 1 10); do
-		$PREAMBLE queuelat -m $MAXLAT -c $CYCLES_PER_PACKET -f "$(get_cpuinfo_mhz)" -p "$mpps" -t 30 > "$OUTFILE"
-		exceeded=$(grep exceeded "$OUTFILE")
-
-		if [ ! -z "$exceeded" ]; then
-			echo "mpps failure (run $i) $mpps"
-			export queuelat_failure=1
-			mpps=$(echo "$mpps" - 0.1 | bc)
-			export mpps
-			break
-		fi
-		echo "run $i success"
-	done
-
-done
+# queuelat calibrates once, then bisects on mpps with 30 second probes
+# and confirms the result with 10 consecutive 30 second runs. It detects
+# the CPU frequency itself.
+OUTFILE=$(mktemp)
+trap 'rm -f "$OUTFILE"' EXIT
+$PREAMBLE queuelat -m $MAXLAT -c $CYCLES_PER_PACKET -s -P 0.1 -T 30 -n 10 | tee "$OUTFILE"
+
+mpps=$(sed -n 's/^maximum sustainable rate: \(.*\) mpps$/\1/p' "$OUTFILE")
+if [ -z "$mpps" ]; then
+	echo "No sustainable mpps found"
+	exit 1
+fi
 
 export queuelat_failure=1
 while [ $queuelat_failure == 1 ]; do
@@ -193,17 +105,23 @@ while [ $queuelat_failure == 1 ]; do
 	echo -n "Starting 10 minutes run with "
 	echo "$mpps Mpps"
 
-	$PREAMBLE queuelat -m $MAXLAT -c $CYCLES_PER_PACKET -f "$(get_cpuinfo_mhz)" -p "$mpps" -t 600 > "$OUTFILE"
-	exceeded=$(grep exceeded "$OUTFILE")
+	# a single probe with the queue model of the search, failing on
+	# the first dropped packet
+	$PREAMBLE queuelat -m $MAXLAT -c $CYCLES_PER_PACKET -o -p "$mpps" -T 600 > "$OUTFILE"
+	passed=$(grep -E '^ *[0-9.]+ mpps: pass,' "$OUTFILE")
 
-	if [ ! -z "$exceeded" ]; then
-		echo "mpps failure (run $i) $mpps"
+	if [ -z "$passed" ]; then
+		echo "mpps failure $mpps"
 		export queuelat_failure=1
 		mpps=$(echo "$mpps" - 0.1 | bc)
 		export mpps
+		if [ "$(echo "$mpps <= 0" | bc)" == 1 ]; then
+			echo "No sustainable mpps found"
+			exit 1
+		fi
 		continue
 	fi
-	echo "run $i success"
+	echo "run success"
 done
 
 echo Final mpps is: "$mpps"
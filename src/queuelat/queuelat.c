@@ -17,24 +17,34 @@
 #include <signal.h>
 #include <time.h>
 #include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 
 #include "rt-utils.h"
+#include "rt-counter.h"
 
 /* Program parameters:
  * max_queue_len: maximum latency allowed, in nanoseconds (int).
  * cycles_per_packet: number of cycles to process one packet (int).
  * mpps(million-packet-per-sec): million packets per second (float).
- * tsc_freq_mhz: TSC frequency in MHz, as measured by TSC PIT calibration 
- * (search for "Detected XXX MHz processor" in dmesg, and use the integer part).
+ * cpu_freq_mhz: CPU frequency in MHz, to convert cycles_per_packet to time
+ * (optional, the TSC frequency on x86, the maximum cpufreq frequency
+ * elsewhere).
+ *
+ * Time is measured with the free running counter of the architecture
+ * (TSC, CNTVCT_EL0, the LoongArch stable counter, ...), whose frequency
+ * is detected.
  *
  * How it works
  * ============
  *
  *  The program in essence does:
  *
- * 		b = rdtsc();
+ * 		b = counter_read();
  * 		memmove(dest, src, n);
- * 		a = rdtsc();
+ * 		a = counter_read();
  *
  * 		delay = convert_to_ns(a - b);
  *
@@ -50,6 +60,28 @@
  * for max_latency/2, we calculate how many packets can be drained
  * in that time (using cycles_per_packet).
  *
+ * Multiple queues
+ * ===============
+ *
+ * With -C, one queue is simulated per CPU of the list, each by a thread
+ * pinned to its CPU, like the RSS queues of a NIC. mpps is the rate of
+ * the whole NIC, spread evenly over the queues, with packets arriving
+ * at a constant rate, as a Poisson process or in bursts which all
+ * queues see at the same time. A full queue drops packets instead of
+ * ending the test, and the maximum depth and drops of every queue are
+ * reported at the end.
+ *
+ * Maximum rate search
+ * ===================
+ *
+ * With -s, the calibration runs once and the highest mpps without drops
+ * is searched in the same process: the rate is doubled until a probe of
+ * -T seconds drops packets, then the interval is bisected down to -P.
+ * The best rate is confirmed with -n more probes and lowered by -P until
+ * all of them pass.
+ *
+ * With -o, a single probe of -T seconds runs at the rate of -p, so that
+ * a longer confirmation uses the same model as the search.
  */
 
 int maxlatency;
@@ -60,12 +92,38 @@ int min_queue_size_to_print;
 
 /* Derived constants */
 
-float cycles_to_ns;
+float ticks_to_ns;			/* counter */
+float cycles_to_ns;			/* CPU */
 int max_queue_len;
 
 int default_n;
 int nr_packets_drain_per_block;
 
+enum arrival_dist {
+	ARRIVAL_CONSTANT,
+	ARRIVAL_POISSON,
+	ARRIVAL_ONOFF,
+};
+
+struct queue {
+	pthread_t thread;
+	int cpu;
+	long long depth;
+	long long max_depth;
+	unsigned long long arrived;
+	unsigned long long drops;
+	double carry;			/* fraction of a packet */
+	uint64_t seed;
+};
+
+int nr_queues;
+struct queue *queues;
+enum arrival_dist arrival_dist = ARRIVAL_CONSTANT;
+double on_ns, off_ns;			/* ARRIVAL_ONOFF */
+volatile sig_atomic_t queues_running;
+volatile sig_atomic_t stop;
+volatile sig_atomic_t interrupted;
+
 /* 
  * Parameters for the stats collection buckets
  */
@@ -256,50 +314,15 @@ typedef unsigned long long cycles_t;
 typedef unsigned long long usecs_t;
 typedef unsigned long long u64;
 
-#if defined __x86_64__ || defined __i386__
-
-#ifdef __x86_64__
-#define DECLARE_ARGS(val, low, high)    unsigned low, high
-#define EAX_EDX_VAL(val, low, high)     ((low) | ((u64)(high) << 32))
-#define EAX_EDX_ARGS(val, low, high)    "a" (low), "d" (high)
-#define EAX_EDX_RET(val, low, high)     "=a" (low), "=d" (high)
-#else
-#define DECLARE_ARGS(val, low, high)    unsigned long long val
-#define EAX_EDX_VAL(val, low, high)     (val)
-#define EAX_EDX_ARGS(val, low, high)    "A" (val)
-#define EAX_EDX_RET(val, low, high)     "=A" (val)
-#endif
-
-static inline unsigned long long __rdtscll(void)
-{
-	DECLARE_ARGS(val, low, high);
-
-	asm volatile("mfence; rdtsc" : EAX_EDX_RET(val, low, high));
-
-	return EAX_EDX_VAL(val, low, high);
-}
-
-#define gettick(val) do { (val) = __rdtscll(); } while (0)
+#define gettick(val) do { (val) = counter_read(); } while (0)
 
-#else
-
-static inline unsigned long long __clock_gettime(void)
+/* The copy is never read, keep the compiler from dropping it */
+static inline void memmove_block(void *dest, void *src, int n)
 {
-	struct timespec now;
-	int ret;
-
-	ret = clock_gettime(CLOCK_MONOTONIC, &now);
-	if (ret < 0)
-		return 0;
-
-	// Combine seconds and nanoseconds into a single value in nanoseconds
-	return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	memmove(dest, src, n);
+	asm volatile("" : : "r" (dest) : "memory");
 }
 
-#define gettick(val) do { (val) = __clock_gettime(); } while (0)
-
-#endif
-
 static void init_buckets(void)
 {
 	int i;
@@ -377,9 +400,9 @@ static void run_n(int n)
 	memmove(dest, src, n);
 	for (i = 0; i < loops; i++) {
 		gettick(b);
-		memmove(dest, src, n);
+		memmove_block(dest, src, n);
 		gettick(a);
-		delta = (a - b) * cycles_to_ns;
+		delta = (a - b) * ticks_to_ns;
 		account(delta);
 	}
 
@@ -421,13 +444,38 @@ static int measure_n(void)
 	return n;
 }
 
-static void convert_to_ghz(double tsc_freq_mhz)
+#define CALIBRATION_CACHE	"/var/tmp/queuelat-counter-hz"
+#define CPU_MAX_FREQ	"/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq"
+
+/* The clock of the CPU cycles of -c, 0 if unknown */
+static double detect_cpu_freq_mhz(uint64_t counter_hz)
 {
-	float tsc_freq_ghz = tsc_freq_mhz/1000;
+#if defined __x86_64__ || defined __i386__
+	/* the TSC runs at the base frequency */
+	return counter_hz / 1e6;
+#else
+	unsigned long khz;
+	FILE *f;
+
+	f = fopen(CPU_MAX_FREQ, "r");
+	if (f == NULL)
+		return 0;
+	if (fscanf(f, "%lu", &khz) != 1)
+		khz = 0;
+	fclose(f);
 
-	cycles_to_ns = 1/tsc_freq_ghz;
+	return khz / 1000.0;
+#endif
+}
 
-	printf("tsc_freq_ghz = %f, cycles_to_ns = %f\n", tsc_freq_ghz,
+static void convert_to_ns(uint64_t counter_freq_hz, double cpu_freq_mhz)
+{
+	ticks_to_ns = 1e9 / counter_freq_hz;
+	cycles_to_ns = 1000 / cpu_freq_mhz;
+
+	printf("counter_freq_mhz = %f, ticks_to_ns = %f\n",
+		counter_freq_hz / 1e6, ticks_to_ns);
+	printf("cpu_freq_mhz = %f, cycles_to_ns = %f\n", cpu_freq_mhz,
 		cycles_to_ns);
 }
 
@@ -474,9 +522,9 @@ void main_loop(void)
 		int nr_packets_fill;
 
 		gettick(b);
-		memmove(dest, src, default_n);
+		memmove_block(dest, src, default_n);
 		gettick(a);
-		delta = (a - b) * cycles_to_ns;
+		delta = (a - b) * ticks_to_ns;
 		account(delta);
 
 		/* fill up the queue by the amount of
@@ -520,8 +568,320 @@ void main_loop(void)
 	free(src);
 }
 
+static inline uint64_t xorshift64(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+/* Uniformly distributed in (0, 1] */
+static inline double uniform(uint64_t *seed)
+{
+	return ((xorshift64(seed) >> 11) + 1) * 0x1.0p-53;
+}
+
+/*
+ * Packets of a Poisson process with the given mean: counted directly
+ * for small means, from the normal approximation for large ones.
+ */
+static long long poisson(double mean, uint64_t *seed)
+{
+	double limit, p, n;
+	long long k;
+
+	if (mean < 30) {
+		limit = exp(-mean);
+		p = uniform(seed);
+		for (k = 0; p > limit; k++)
+			p *= uniform(seed);
+		return k;
+	}
+
+	n = mean + sqrt(mean) * sqrt(-2 * log(uniform(seed))) *
+		cos(2 * M_PI * uniform(seed)) + 0.5;
+	return n > 0 ? n : 0;
+}
+
+/* Time in on periods from the start of the test to t */
+static double on_time(double t)
+{
+	double period = on_ns + off_ns;
+	double phase = fmod(t, period);
+
+	return (t - phase) / period * on_ns + (phase < on_ns ? phase : on_ns);
+}
+
+/* Packets arriving at queue q between t0 and t1, ns since the start */
+static long long arrivals(struct queue *q, double t0, double t1)
+{
+	/* packets per ns */
+	double rate = mpps * 1000000 / NSEC_PER_SEC / nr_queues;
+	double expect;
+	long long n;
+
+	switch (arrival_dist) {
+	case ARRIVAL_POISSON:
+		return poisson(rate * (t1 - t0), &q->seed);
+	case ARRIVAL_ONOFF:
+		expect = rate * (on_ns + off_ns) / on_ns *
+			(on_time(t1) - on_time(t0));
+		break;
+	default:
+		expect = rate * (t1 - t0);
+		break;
+	}
+
+	expect += q->carry;
+	n = expect;
+	q->carry = expect - n;
+	return n;
+}
+
+u64 start_tick;
+u64 probe_ticks;			/* length of a probe of -s */
+
+static void *queue_loop(void *arg)
+{
+	struct queue *q = arg;
+	u64 a, b, prev;
+	void *dest, *src;
+	long long n;
+
+	dest = malloc(default_n);
+	src = malloc(default_n);
+	if (dest == NULL || src == NULL) {
+		printf("failure to allocate %d bytes for queue %d\n",
+		       default_n, (int)(q - queues));
+		exit(1);
+	}
+
+	memset(src, 0, default_n);
+	memmove(dest, src, default_n);
+
+	gettick(prev);
+	while (!stop) {
+		char buf[500];
+		int ret;
+
+		gettick(b);
+		memmove_block(dest, src, default_n);
+		gettick(a);
+
+		/* everything arriving since the previous block */
+		n = arrivals(q, (double)(prev - start_tick) * ticks_to_ns,
+			     (double)(a - start_tick) * ticks_to_ns);
+		prev = a;
+		q->arrived += n;
+		q->depth += n - nr_packets_drain_per_block;
+		if (q->depth < 0)
+			q->depth = 0;
+
+		if (q->depth > max_queue_len) {
+			q->drops += q->depth - max_queue_len;
+			q->depth = max_queue_len;
+			/* a probe has failed with the first drop */
+			if (probe_ticks)
+				stop = 1;
+		}
+		if (q->depth > q->max_depth)
+			q->max_depth = q->depth;
+		if (probe_ticks && a - start_tick >= probe_ticks)
+			break;
+
+		if (!tracing_mark_fd || q->depth <= min_queue_size_to_print)
+			continue;
+
+		ret = sprintf(buf, "queue %d memmove block queue_size=%lld"
+			      " queue_dec=%d queue_inc=%lld delta=%llu ns\n",
+			      (int)(q - queues), q->depth,
+			      nr_packets_drain_per_block, n,
+			      (u64)((a - b) * ticks_to_ns));
+		trace_write(buf, ret);
+	}
+
+	free(dest);
+	free(src);
+	return NULL;
+}
+
+static void print_queues(void)
+{
+	unsigned long long arrived = 0, drops = 0;
+	long long max_depth = 0;
+	int i;
+
+	printf("%-6s %4s %14s %10s %12s %8s\n", "Queue", "CPU", "Packets",
+	       "Max depth", "Drops", "Drop%");
+	for (i = 0; i < nr_queues; i++) {
+		struct queue *q = &queues[i];
+
+		printf("%-6d %4d %14llu %10lld %12llu %8.3f\n", i, q->cpu,
+		       q->arrived, q->max_depth, q->drops,
+		       q->arrived ? 100.0 * q->drops / q->arrived : 0.0);
+		arrived += q->arrived;
+		drops += q->drops;
+		if (q->max_depth > max_depth)
+			max_depth = q->max_depth;
+	}
+	printf("%-6s %4s %14llu %10lld %12llu %8.3f\n", "All", "-", arrived,
+	       max_depth, drops, arrived ? 100.0 * drops / arrived : 0.0);
+}
+
+/*
+ * Run one thread per queue, pinned unless its CPU is -1, until the
+ * timeout, a signal or the end of a probe
+ */
+static void run_queues(void)
+{
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	int i, ret;
+
+	gettick(start_tick);
+	for (i = 0; i < nr_queues; i++) {
+		struct queue *q = &queues[i];
+
+		q->seed = (start_tick ^ ((u64)i << 32)) | 1;
+		pthread_attr_init(&attr);
+		if (q->cpu >= 0) {
+			CPU_ZERO(&cpus);
+			CPU_SET(q->cpu, &cpus);
+			pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+		}
+		ret = pthread_create(&q->thread, &attr, queue_loop, q);
+		pthread_attr_destroy(&attr);
+		if (ret) {
+			printf("failure to create the thread of queue %d: %s\n",
+			       i, strerror(ret));
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < nr_queues; i++)
+		pthread_join(queues[i].thread, NULL);
+}
+
+/*
+ * Simulate the queues at rate for one probe: 1 if no packet was dropped,
+ * 0 if one was, -1 if the search was interrupted
+ */
+static int probe(double rate, long long *max_depth)
+{
+	unsigned long long arrived = 0, drops = 0;
+	int i;
+
+	mpps = rate;
+	stop = 0;
+	for (i = 0; i < nr_queues; i++) {
+		struct queue *q = &queues[i];
+
+		q->depth = q->max_depth = 0;
+		q->arrived = q->drops = 0;
+		q->carry = 0;
+	}
+
+	run_queues();
+	if (interrupted)
+		return -1;
+
+	*max_depth = 0;
+	for (i = 0; i < nr_queues; i++) {
+		arrived += queues[i].arrived;
+		drops += queues[i].drops;
+		if (queues[i].max_depth > *max_depth)
+			*max_depth = queues[i].max_depth;
+	}
+	printf("%10.3f mpps: %s, %llu packets, max depth %lld\n", rate,
+	       drops ? "fail" : "pass", arrived, *max_depth);
+	fflush(stdout);
+
+	return !drops;
+}
+
+/*
+ * Search the highest rate which passes confirm probes in a row, starting
+ * at rate, to within precision
+ */
+static void search_mpps(double rate, double precision, int probe_secs,
+			int confirm)
+{
+	double lo = 0, hi = 0;
+	long long depth, max_depth = 0;
+	int ret, passed = 0;
+
+	/* double the rate until a probe fails */
+	while (!hi) {
+		ret = probe(rate, &depth);
+		if (ret < 0)
+			goto out;
+		if (ret) {
+			lo = rate;
+			rate *= 2;
+		} else {
+			hi = rate;
+		}
+	}
+
+	while (hi - lo > precision) {
+		rate = (lo + hi) / 2;
+		ret = probe(rate, &depth);
+		if (ret < 0)
+			goto out;
+		if (ret)
+			lo = rate;
+		else
+			hi = rate;
+	}
+
+	/* confirm the result, stepping down on a failure */
+	while (lo > 0) {
+		printf("confirming %.3f mpps with %d probes\n", lo, confirm);
+		max_depth = 0;
+		for (passed = 0; passed < confirm; passed++) {
+			ret = probe(lo, &depth);
+			if (ret < 0)
+				goto out;
+			if (!ret)
+				break;
+			if (depth > max_depth)
+				max_depth = depth;
+		}
+		if (passed == confirm)
+			break;
+		hi = lo;
+		lo -= precision;
+	}
+
+out:
+	if (interrupted)
+		printf("search interrupted, the result is not confirmed\n");
+	if (lo <= 0) {
+		printf("no sustainable rate found\n");
+		if (hi)
+			printf("failed at %.3f mpps\n", hi);
+		return;
+	}
+	printf("maximum sustainable rate: %.3f mpps\n", lo);
+	printf("passed %d of %d confirmation probes of %d s, max depth %lld"
+	       " of %d\n", passed, confirm, probe_secs, max_depth,
+	       max_queue_len);
+	if (hi)
+		printf("failed at %.3f mpps\n", hi);
+	else
+		printf("no failing rate found\n");
+}
+
 void sig_handler(int sig)
 {
+	if (queues_running) {
+		interrupted = 1;
+		stop = 1;
+		return;
+	}
 	print_exit_info();
 	exit(0);
 }
@@ -565,19 +925,36 @@ static void print_help(int error)
 	printf("Usage:\n"
 	       "queuelat <options>\n\n"
 	       "-c N     --cycles N        number of cycles to process one packet (int)\n"
-	       "-f F     --freq F          TSC frequency in MHz (float)\n"
+	       "-C CPUS  --cpus CPUS       simulate one queue per CPU in the list, on a\n"
+	       "                           pinned thread each, sharing the packet rate\n"
+	       "-d DIST  --distribution DIST\n"
+	       "                           packet arrivals with -C: constant (default),\n"
+	       "                           poisson or onoff:ON,OFF (bursts of ON us\n"
+	       "                           every ON+OFF us, at the same average rate)\n"
+	       "-f F     --freq F          CPU frequency in MHz (float), to convert -c\n"
+	       "                           to time, detected if not given\n"
 	       "-h       --help            show this help menu\n"
 	       "-m LEN   --max-len LEN     maximum latency allowed, in nanoseconds (int)\n"
-	       "-p F     --packets F       million packets per second (float)\n"
+	       "-n N     --confirm N       probes confirming the rate found by -s,\n"
+	       "                           default 10\n"
+	       "-o       --once            run a single probe of -T at the rate of -p,\n"
+	       "                           exit status 1 if it drops packets\n"
+	       "-p F     --packets F       million packets per second (float), the\n"
+	       "                           starting rate with -s\n"
+	       "-P F     --precision F     precision of -s in mpps, default 0.1\n"
 	       "-q N     --queue-len N     minimum queue len to print trace (int)\n"
+	       "-s       --search          search the maximum rate without drops\n"
 	       "-t TIME  --timeout TIME    timeout, in seconds (int)\n"
+	       "-T TIME  --probe-time TIME length of a probe of -s, in seconds,\n"
+	       "                           default 10\n"
 	       );
 	exit(error);
 }
 
 int main(int argc, char **argv)
 {
-	double tsc_freq_mhz;
+	uint64_t counter_freq_hz;
+	double cpu_freq_mhz;
 	float max_queue_len_f;
 	char *mvalue = NULL;
 	char *cvalue = NULL;
@@ -585,27 +962,51 @@ int main(int argc, char **argv)
 	char *fvalue = NULL;
 	char *tvalue = NULL;
 	char *qvalue = NULL;
+	char *Cvalue = NULL;
+	char *dvalue = NULL;
+	double precision = 0.1;
+	int probe_secs = 10;
+	int confirm = 10;
+	int search = 0;
+	int once = 0;
+	cpu_set_t cpus;
+	double on, off;
+	int i, cpu;
 
 	opterr = 0;
 
 	for (;;) {
 		static struct option options[] = {
 			{"cycles",	required_argument,	NULL, 'c'},
+			{"cpus",	required_argument,	NULL, 'C'},
+			{"distribution", required_argument,	NULL, 'd'},
 			{"freq",	required_argument,	NULL, 'f'},
 			{"help",	no_argument,		NULL, 'h'},
 			{"max-len",	required_argument,	NULL, 'm'},
+			{"confirm",	required_argument,	NULL, 'n'},
+			{"once",	no_argument,		NULL, 'o'},
 			{"packets",	required_argument,	NULL, 'p'},
+			{"precision",	required_argument,	NULL, 'P'},
 			{"queue-len",	required_argument,	NULL, 'q'},
+			{"search",	no_argument,		NULL, 's'},
 			{"timeout",	required_argument,	NULL, 't'},
+			{"probe-time",	required_argument,	NULL, 'T'},
 			{NULL, 0, NULL, 0}
 		};
-		int c = getopt_long(argc, argv, "c:f:hm:p:q:t:", options, NULL);
+		int c = getopt_long(argc, argv, "c:C:d:f:hm:n:op:P:q:st:T:",
+				    options, NULL);
 		if (c == -1)
 			break;
 		switch (c) {
 		case 'c':
 			cvalue = optarg;
 			break;
+		case 'C':
+			Cvalue = optarg;
+			break;
+		case 'd':
+			dvalue = optarg;
+			break;
 		case 'f':
 			fvalue = optarg;
 			break;
@@ -616,32 +1017,121 @@ int main(int argc, char **argv)
 		case 'm':
 			mvalue = optarg;
 			break;
+		case 'n':
+			confirm = atoi(optarg);
+			break;
+		case 'o':
+			once = 1;
+			break;
 		case 'p':
 			pvalue = optarg;
 			break;
+		case 'P':
+			precision = atof(optarg);
+			break;
 		case 'q':
 			qvalue = optarg;
 			break;
+		case 's':
+			search = 1;
+			break;
 		case 't':
 			tvalue = optarg;
 			break;
+		case 'T':
+			probe_secs = atoi(optarg);
+			break;
 		default:
 			print_help(1);
 			break;
 		}
 	}
 
-	if (mvalue == NULL || cvalue == NULL || pvalue == NULL || fvalue == NULL) {
-		printf("options -m, -c, -p and -f are required\n");
+	if (mvalue == NULL || cvalue == NULL || (pvalue == NULL && !search)) {
+		printf("options -m, -c and -p are required\n");
+		exit(1);
+	}
+
+	if (search && (precision <= 0 || probe_secs <= 0 || confirm <= 0)) {
+		printf("-P, -T and -n must be positive\n");
+		exit(1);
+	}
+
+	if (once && (search || probe_secs <= 0)) {
+		printf("-o needs a positive -T and can't be used with -s\n");
+		exit(1);
+	}
+
+	if (dvalue && !Cvalue) {
+		printf("option -d needs -C\n");
+		exit(1);
+	}
+	if (dvalue == NULL || !strcmp(dvalue, "constant")) {
+		arrival_dist = ARRIVAL_CONSTANT;
+	} else if (!strcmp(dvalue, "poisson")) {
+		arrival_dist = ARRIVAL_POISSON;
+	} else if (sscanf(dvalue, "onoff:%lf,%lf", &on, &off) == 2 &&
+		   on > 0 && off >= 0) {
+		arrival_dist = ARRIVAL_ONOFF;
+		on_ns = on * 1000;
+		off_ns = off * 1000;
+	} else {
+		printf("invalid arrival distribution %s\n", dvalue);
 		exit(1);
 	}
 
+	if (Cvalue) {
+		if (parse_cpulist(Cvalue, &cpus) || !CPU_COUNT(&cpus)) {
+			printf("invalid CPU list %s\n", Cvalue);
+			exit(1);
+		}
+		nr_queues = CPU_COUNT(&cpus);
+		queues = calloc(nr_queues, sizeof(*queues));
+		if (queues == NULL) {
+			printf("failure to allocate %d queues\n", nr_queues);
+			exit(1);
+		}
+		for (i = 0, cpu = 0; i < nr_queues; cpu++)
+			if (CPU_ISSET(cpu, &cpus))
+				queues[i++].cpu = cpu;
+
+		/* calibrate on a CPU of the queues */
+		CPU_ZERO(&cpus);
+		CPU_SET(queues[0].cpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus)) {
+			perror("sched_setaffinity");
+			exit(1);
+		}
+	} else if (search || once) {
+		/* a single queue on the CPUs of the process */
+		nr_queues = 1;
+		queues = calloc(1, sizeof(*queues));
+		if (queues == NULL) {
+			printf("failure to allocate the queue\n");
+			exit(1);
+		}
+		queues[0].cpu = -1;
+	}
+
 	install_signals();
 
 	maxlatency = atoi(mvalue);
 	cycles_per_packet = atoi(cvalue);
-	mpps = atof(pvalue);
-	tsc_freq_mhz = atof(fvalue);
+	mpps = pvalue ? atof(pvalue) : 1;
+	if ((search || once) && mpps <= 0) {
+		printf("-s and -o need a positive -p\n");
+		exit(1);
+	}
+
+	counter_freq_hz = counter_hz(CALIBRATION_CACHE);
+	if (fvalue)
+		cpu_freq_mhz = atof(fvalue);
+	else
+		cpu_freq_mhz = detect_cpu_freq_mhz(counter_freq_hz);
+	if (cpu_freq_mhz <= 0) {
+		printf("could not detect the CPU frequency, give it with -f\n");
+		exit(1);
+	}
 
 	if (tvalue) {
 		int alarm_secs;
@@ -652,7 +1142,7 @@ int main(int argc, char **argv)
 	if (qvalue)
 		min_queue_size_to_print = atoi(qvalue);
 
-	convert_to_ghz(tsc_freq_mhz);
+	convert_to_ns(counter_freq_hz, cpu_freq_mhz);
 
 	max_queue_len_f = maxlatency / (cycles_per_packet*cycles_to_ns);
 	max_queue_len = max_queue_len_f;
@@ -661,11 +1151,33 @@ int main(int argc, char **argv)
 	default_n = measure_n();
 
 	nr_packets_drain_per_block = calculate_nr_packets_drain_per_block();
-	print_all_buckets_drainlength();
+	if (!search && !once)
+		print_all_buckets_drainlength();
 
 	printf("default_n=%d nr_packets_drain_per_block=%d\n", default_n,
 		nr_packets_drain_per_block);
 
+	if (nr_queues) {
+		/* the trace is optional here, ask for it with -q */
+		if (qvalue)
+			trace_open();
+		queues_running = 1;
+		if (search || once)
+			probe_ticks = (u64)probe_secs * counter_freq_hz;
+		if (search) {
+			search_mpps(mpps, precision, probe_secs, confirm);
+			return 0;
+		}
+		if (once) {
+			long long depth;
+
+			return probe(mpps, &depth) == 1 ? 0 : 1;
+		}
+		run_queues();
+		print_queues();
+		return 0;
+	}
+
 	main_loop();
 
 	return 0;
@@ -0,0 +1,947 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * rt-suite - run several rt-tests concurrently from a scenario file
+ *
+ * The scenario lists one test per line:
+ *
+ *   # role   name        cpus   command line
+ *   load     hackbench   0      hackbench -g 4 -l 1000000
+ *   measure  cyclictest  1-3    cyclictest -m -a 1-3 -t 3 -p 95 -D 60
+ *   ipc      ptsematest  2      ptsematest -a 2 -p 90 -D 60
+ *
+ * All tests are forked up front and block on a start gate until every
+ * one of them is ready. Load tests are released first, measurement and
+ * IPC tests after the warmup time. Once the last measurement or IPC test
+ * has finished the load tests are stopped.
+ *
+ * Tests which know --json get a result file each. The combined result
+ * document carries a common record per test (role, cpus, start offset,
+ * runtime, exit status) with the test's own document under "result".
+ * The per thread statistics of that document are also put under "stats"
+ * in the same shape for every tool:
+ *
+ *   "stats": {
+ *     "units": "us",
+ *     "threads": [
+ *       { "thread": 0, "cpu": 1, "samples": 59983, "min": 2,
+ *         "avg": 3.1, "max": 17, "overflows": null }
+ *     ]
+ *   }
+ *
+ * Values a tool does not report are null.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <numa.h>
+
+#include "rt-utils.h"
+#include "rt-error.h"
+
+#define MAX_TESTS	64
+#define MAX_ARGS	64
+#define MAX_NAME	64
+
+enum role {
+	ROLE_LOAD,
+	ROLE_MEASURE,
+	ROLE_IPC,
+};
+
+static const char * const role_names[] = {
+	[ROLE_LOAD]	= "load",
+	[ROLE_MEASURE]	= "measure",
+	[ROLE_IPC]	= "ipc",
+};
+
+/* load tests go through the first gate, everything else the second */
+enum stage {
+	STAGE_LOAD,
+	STAGE_TEST,
+	NR_STAGES,
+};
+
+struct test {
+	char name[MAX_NAME];
+	enum role role;
+	char *cpus;
+	char *cmdline;
+	char *argv[MAX_ARGS + 2];
+	int argc;
+	char jsonfile[MAX_PATH];
+	const struct json_tool *tool;
+	pid_t pid;
+	int status;
+	int running;
+	int stopped;	/* terminated by us */
+	struct timespec end;
+};
+
+/* Written by the children right before exec, hence shared */
+struct start_stamp {
+	struct timespec ts;
+	int started;
+};
+
+/*
+ * Tools which write their results with rt_write_json(), and where the
+ * statistics live below each "thread": { "<n>": ... } member
+ */
+static const struct json_tool {
+	const char *name;
+	const char *stats;	/* member with min, avg, max and cpu */
+	const char *samples;	/* member counting the samples */
+} json_tools[] = {
+	{ "cyclictest",		"",		"cycles" },
+	{ "cyclicdeadline",	"",		"cycles" },
+	{ "oslat",		"",		"histogram" },
+	{ "pi_stress",		NULL,		NULL },
+	{ "pmqtest",		"receiver",	"sender.samples" },
+	{ "ptsematest",		"receiver",	"sender.samples" },
+	{ "rt-migrate-test",	"",		NULL },
+	{ "signaltest",		"",		"cycles" },
+	{ "sigwaittest",	"receiver",	"sender.samples" },
+	{ "ssdd",		NULL,		NULL },
+	{ "svsematest",		"receiver",	"sender.samples" },
+};
+
+static struct test tests[MAX_TESTS];
+static int nr_tests;
+static struct start_stamp *stamps;
+static struct timespec released[NR_STAGES];
+
+static char *scenario;
+static char jsonfile[MAX_PATH];
+static char tmpdir[MAX_PATH];
+static char exedir[MAX_PATH];
+static int duration;
+static int warmup;
+static int verbose;
+
+static volatile sig_atomic_t stop;
+
+enum option_values {
+	OPT_DURATION = 1, OPT_HELP, OPT_JSON, OPT_VERBOSE, OPT_WARMUP,
+};
+
+static void usage(int error)
+{
+	printf("rt-suite V %1.2f\n", VERSION);
+	printf("Usage:\n"
+	       "rt-suite <options> SCENARIO\n\n"
+	       "-D       --duration=TIME   stop all tests after TIME, e.g. 60, 10m, 2h\n"
+	       "-h       --help            print this message\n"
+	       "         --json=FILENAME   write the combined results into FILENAME,\n"
+	       "                           JSON formatted\n"
+	       "-v       --verbose         don't discard the output of the tests\n"
+	       "-w TIME  --warmup=TIME     run the load tests for TIME before starting\n"
+	       "                           the measurement and IPC tests\n"
+	       "\n"
+	       "SCENARIO lines: ROLE NAME CPUS COMMAND [ARGS...]\n"
+	       "  ROLE is one of load, measure or ipc\n"
+	       "  CPUS is a cpu list the test is confined to, or - for no pinning\n"
+	       );
+	exit(error);
+}
+
+static void process_options(int argc, char *argv[])
+{
+	for (;;) {
+		int option_index = 0;
+		/*
+		 * Options for getopt
+		 * Ordered alphabetically by single letter name
+		 */
+		static struct option long_options[] = {
+			{"duration",	required_argument,	NULL, OPT_DURATION},
+			{"help",	no_argument,		NULL, OPT_HELP},
+			{"json",	required_argument,	NULL, OPT_JSON},
+			{"verbose",	no_argument,		NULL, OPT_VERBOSE},
+			{"warmup",	required_argument,	NULL, OPT_WARMUP},
+			{NULL, 0, NULL, 0},
+		};
+		int c = getopt_long(argc, argv, "D:hvw:",
+				    long_options, &option_index);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'D':
+		case OPT_DURATION:
+			duration = parse_time_string(optarg);
+			break;
+		case '?':
+		case 'h':
+		case OPT_HELP:
+			usage(0);
+			break;
+		case OPT_JSON:
+			strncpy(jsonfile, optarg, strnlen(optarg, MAX_PATH-1));
+			break;
+		case 'v':
+		case OPT_VERBOSE:
+			verbose = 1;
+			break;
+		case 'w':
+		case OPT_WARMUP:
+			warmup = parse_time_string(optarg);
+			break;
+		default:
+			usage(1);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(1);
+	scenario = argv[optind];
+
+	if (duration < 0 || warmup < 0)
+		usage(1);
+}
+
+static int parse_role(const char *str)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(role_names); i++) {
+		if (!strcmp(str, role_names[i]))
+			return i;
+	}
+
+	return -1;
+}
+
+static const struct json_tool *find_json_tool(const char *cmd)
+{
+	char buf[MAX_PATH];
+	const char *base;
+	int i;
+
+	strncpy(buf, cmd, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = '\0';
+	base = basename(buf);
+
+	for (i = 0; i < ARRAY_SIZE(json_tools); i++) {
+		if (!strcmp(base, json_tools[i].name))
+			return &json_tools[i];
+	}
+
+	return NULL;
+}
+
+static void parse_scenario(const char *path)
+{
+	char line[4096];
+	int lineno = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		fatal("could not open scenario '%s': %s\n", path, strerror(errno));
+
+	while (fgets(line, sizeof(line), f)) {
+		struct test *t = &tests[nr_tests];
+		char *tok, *save, *s;
+		int role;
+
+		lineno++;
+		line[strcspn(line, "#\n")] = '\0';
+
+		tok = strtok_r(line, " \t", &save);
+		if (!tok)
+			continue;
+
+		if (nr_tests == MAX_TESTS)
+			fatal("%s:%d: too many tests (max %d)\n",
+			      path, lineno, MAX_TESTS);
+
+		role = parse_role(tok);
+		if (role < 0)
+			fatal("%s:%d: unknown role '%s'\n", path, lineno, tok);
+		t->role = role;
+
+		tok = strtok_r(NULL, " \t", &save);
+		if (!tok)
+			fatal("%s:%d: missing test name\n", path, lineno);
+		snprintf(t->name, sizeof(t->name), "%s", tok);
+
+		tok = strtok_r(NULL, " \t", &save);
+		if (!tok)
+			fatal("%s:%d: missing cpu list\n", path, lineno);
+		if (strcmp(tok, "-"))
+			t->cpus = strdup(tok);
+
+		/* keep the command line around for the result document */
+		s = save + strspn(save, " \t");
+		t->cmdline = strdup(s);
+		if (!t->cmdline)
+			fatal("out of memory\n");
+		s = strdup(s);
+
+		for (tok = strtok_r(s, " \t", &save); tok;
+		     tok = strtok_r(NULL, " \t", &save)) {
+			if (t->argc == MAX_ARGS)
+				fatal("%s:%d: too many arguments\n",
+				      path, lineno);
+			t->argv[t->argc++] = tok;
+		}
+		if (!t->argc)
+			fatal("%s:%d: missing command\n", path, lineno);
+
+		t->tool = find_json_tool(t->argv[0]);
+		nr_tests++;
+	}
+	fclose(f);
+
+	if (!nr_tests)
+		fatal("%s: no tests found\n", path);
+}
+
+/* Prefer the tools next to rt-suite over whatever is in $PATH */
+static void find_exedir(void)
+{
+	char buf[MAX_PATH];
+	ssize_t n;
+
+	n = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+	if (n < 0)
+		return;
+	buf[n] = '\0';
+	strcpy(exedir, dirname(buf));
+}
+
+static void exec_test(struct test *t)
+{
+	char path[2 * MAX_PATH];
+
+	if (!strchr(t->argv[0], '/') && exedir[0]) {
+		snprintf(path, sizeof(path), "%s/%s", exedir, t->argv[0]);
+		if (!access(path, X_OK))
+			execv(path, t->argv);
+	}
+	execvp(t->argv[0], t->argv);
+}
+
+static void start_test(int idx, int gates[NR_STAGES][2])
+{
+	struct test *t = &tests[idx];
+	enum stage st = t->role == ROLE_LOAD ? STAGE_LOAD : STAGE_TEST;
+	struct bitmask *mask;
+	char buf;
+	int fd, i;
+
+	t->pid = fork();
+	if (t->pid < 0)
+		fatal("fork failed: %s\n", strerror(errno));
+	if (t->pid > 0) {
+		t->running = 1;
+		return;
+	}
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGALRM, SIG_DFL);
+
+	if (t->cpus) {
+		mask = numa_parse_cpustring_all(t->cpus);
+		if (!mask || numa_sched_setaffinity(0, mask))
+			err_exit(errno, "%s: could not set affinity to %s",
+				 t->name, t->cpus);
+		numa_bitmask_free(mask);
+	}
+
+	if (!verbose) {
+		fd = open("/dev/null", O_WRONLY);
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			close(fd);
+		}
+	}
+
+	/* The gate opens once the last write end is closed */
+	for (i = 0; i < NR_STAGES; i++)
+		close(gates[i][1]);
+	while (read(gates[st][0], &buf, 1) < 0 && errno == EINTR)
+		;
+
+	clock_gettime(CLOCK_MONOTONIC, &stamps[idx].ts);
+	stamps[idx].started = 1;
+
+	exec_test(t);
+	err_exit(errno, "%s: could not run %s", t->name, t->argv[0]);
+}
+
+static void stop_tests(int sig, int load)
+{
+	int i;
+
+	for (i = 0; i < nr_tests; i++) {
+		struct test *t = &tests[i];
+
+		if (!t->running || (t->role == ROLE_LOAD) != load)
+			continue;
+		kill(t->pid, sig);
+		t->stopped = 1;
+	}
+}
+
+static void sighand(int sig)
+{
+	/* SIGCHLD only has to wake up the main loop */
+	if (sig != SIGCHLD)
+		stop = 1;
+}
+
+/* Sleep for sec seconds or until a stop was requested */
+static void wait_warmup(int sec)
+{
+	struct timespec ts = { .tv_sec = sec };
+
+	while (!stop && nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+static int count_running(int load)
+{
+	int i, n = 0;
+
+	for (i = 0; i < nr_tests; i++) {
+		if (tests[i].running && (tests[i].role == ROLE_LOAD) == load)
+			n++;
+	}
+
+	return n;
+}
+
+static void reap(pid_t pid, int status)
+{
+	int i;
+
+	for (i = 0; i < nr_tests; i++) {
+		struct test *t = &tests[i];
+
+		if (t->pid != pid)
+			continue;
+		t->running = 0;
+		t->status = status;
+		clock_gettime(CLOCK_MONOTONIC, &t->end);
+		info(verbose, "%s finished\n", t->name);
+		return;
+	}
+}
+
+static int test_failed(struct test *t)
+{
+	if (WIFEXITED(t->status))
+		return WEXITSTATUS(t->status) != 0;
+
+	/* a load test killed by us did its job */
+	return !(t->stopped && t->role == ROLE_LOAD);
+}
+
+/*
+ * Just enough of a JSON reader to pick the statistics out of the result
+ * documents of the tools. Strings are only kept as member names.
+ */
+enum json_type {
+	JSON_NULL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT,
+};
+
+struct json {
+	enum json_type type;
+	char *key;		/* member name within an object */
+	double num;
+	struct json *child;	/* first member or element */
+	struct json *next;
+};
+
+static void json_free(struct json *j)
+{
+	struct json *next;
+
+	for (; j; j = next) {
+		next = j->next;
+		json_free(j->child);
+		free(j->key);
+		free(j);
+	}
+}
+
+static const char *json_skip(const char *p)
+{
+	return p + strspn(p, " \t\r\n");
+}
+
+/* Returns the string at *pp without quotes and escapes, NULL on errors */
+static char *json_parse_string(const char **pp)
+{
+	const char *p = *pp + 1, *end;
+	char *str, *d;
+
+	for (end = p; *end && *end != '"'; end++) {
+		if (*end == '\\' && !*++end)
+			return NULL;
+	}
+	if (!*end)
+		return NULL;
+
+	str = d = malloc(end - p + 1);
+	if (!str)
+		return NULL;
+	for (; p < end; p++) {
+		if (*p != '\\') {
+			*d++ = *p;
+			continue;
+		}
+		switch (*++p) {
+		case 'n':	*d++ = '\n'; break;
+		case 't':	*d++ = '\t'; break;
+		case 'u':	/* only used for control characters */
+			*d++ = '?';
+			p += strnlen(p + 1, 4);
+			break;
+		default:	*d++ = *p; break;
+		}
+	}
+	*d = '\0';
+	*pp = end + 1;
+
+	return str;
+}
+
+static struct json *json_parse(const char **pp)
+{
+	const char *p = json_skip(*pp);
+	struct json *j, **tail;
+	char close, *end;
+
+	j = calloc(1, sizeof(*j));
+	if (!j)
+		return NULL;
+
+	switch (*p) {
+	case '{':
+	case '[':
+		j->type = *p == '{' ? JSON_OBJECT : JSON_ARRAY;
+		close = *p == '{' ? '}' : ']';
+		tail = &j->child;
+		p = json_skip(p + 1);
+		if (*p == close) {
+			p++;
+			break;
+		}
+		for (;;) {
+			char *key = NULL;
+
+			if (j->type == JSON_OBJECT) {
+				p = json_skip(p);
+				if (*p != '"' || !(key = json_parse_string(&p)))
+					goto err;
+				p = json_skip(p);
+				if (*p++ != ':') {
+					free(key);
+					goto err;
+				}
+			}
+			*tail = json_parse(&p);
+			if (!*tail) {
+				free(key);
+				goto err;
+			}
+			(*tail)->key = key;
+			tail = &(*tail)->next;
+
+			p = json_skip(p);
+			if (*p == ',') {
+				p++;
+				continue;
+			}
+			if (*p++ != close)
+				goto err;
+			break;
+		}
+		break;
+	case '"':
+		j->type = JSON_STRING;
+		end = json_parse_string(&p);
+		if (!end)
+			goto err;
+		free(end);
+		break;
+	default:
+		if (!strncmp(p, "null", 4)) {
+			j->type = JSON_NULL;
+			p += 4;
+		} else if (!strncmp(p, "true", 4) || !strncmp(p, "false", 5)) {
+			j->type = JSON_NUMBER;
+			j->num = *p == 't';
+			p += *p == 't' ? 4 : 5;
+		} else {
+			j->type = JSON_NUMBER;
+			j->num = strtod(p, &end);
+			if (end == p)
+				goto err;
+			p = end;
+		}
+	}
+	*pp = p;
+
+	return j;
+
+err:
+	json_free(j);
+	return NULL;
+}
+
+/* Member @path of @j, nested members separated by dots */
+static struct json *json_get(struct json *j, const char *path)
+{
+	size_t len;
+
+	while (j && *path) {
+		len = strcspn(path, ".");
+		for (j = j->child; j; j = j->next) {
+			if (j->key && strlen(j->key) == len &&
+			    !strncmp(j->key, path, len))
+				break;
+		}
+		path += len + (path[len] == '.');
+	}
+
+	return j;
+}
+
+/* The result document of @t without the trailing newline, or NULL */
+static char *read_result(struct test *t)
+{
+	char *buf = NULL;
+	size_t len = 0, n;
+	FILE *r;
+
+	r = t->tool ? fopen(t->jsonfile, "r") : NULL;
+	if (!r)
+		return NULL;
+
+	do {
+		char *tmp = realloc(buf, len + 4096 + 1);
+
+		if (!tmp) {
+			free(buf);
+			fclose(r);
+			return NULL;
+		}
+		buf = tmp;
+		n = fread(buf + len, 1, 4096, r);
+		len += n;
+	} while (n > 0);
+	fclose(r);
+
+	if (len && buf[len - 1] == '\n')
+		len--;
+	buf[len] = '\0';
+
+	return buf;
+}
+
+static void write_value(FILE *f, const char *key, struct json *j)
+{
+	if (j && j->type == JSON_NUMBER)
+		fprintf(f, "\"%s\": %.15g", key, j->num);
+	else
+		fprintf(f, "\"%s\": null", key);
+}
+
+/* The statistics of every thread in the same shape for all tools */
+static void write_normalized(FILE *f, struct test *t, struct json *doc)
+{
+	struct json *threads, *th, *st, *n, *res;
+	struct json sum = { .type = JSON_NUMBER };
+
+	threads = doc && t->tool->stats ? json_get(doc, "thread") : NULL;
+	if (!threads || threads->type != JSON_OBJECT) {
+		fprintf(f, "null");
+		return;
+	}
+
+	res = json_get(doc, "resolution_in_ns");
+	fprintf(f, "{\n");
+	fprintf(f, "        \"units\": \"%s\",\n",
+		res && res->num ? "ns" : "us");
+	fprintf(f, "        \"threads\": [");
+	for (th = threads->child; th; th = th->next) {
+		st = json_get(th, t->tool->stats);
+
+		/* a histogram counts the samples in its buckets */
+		n = t->tool->samples ? json_get(th, t->tool->samples) : NULL;
+		if (n && n->type == JSON_OBJECT) {
+			for (sum.num = 0, n = n->child; n; n = n->next)
+				sum.num += n->num;
+			n = &sum;
+		}
+
+		fprintf(f, "%s\n          { \"thread\": %d, ",
+			th == threads->child ? "" : ",", atoi(th->key));
+		write_value(f, "cpu", json_get(st, "cpu"));
+		fprintf(f, ", ");
+		write_value(f, "samples", n);
+		fprintf(f, ", ");
+		write_value(f, "min", json_get(st, "min"));
+		fprintf(f, ", ");
+		write_value(f, "avg", json_get(st, "avg"));
+		fprintf(f, ", ");
+		write_value(f, "max", json_get(st, "max"));
+		fprintf(f, ", ");
+		write_value(f, "overflows", json_get(st, "overflows"));
+		fprintf(f, " }");
+	}
+	fprintf(f, "\n        ]\n      }");
+}
+
+static void write_result(FILE *f, struct test *t)
+{
+	const char *p;
+	struct json *doc;
+	char *buf;
+
+	buf = read_result(t);
+	p = buf;
+	doc = buf ? json_parse(&p) : NULL;
+
+	fprintf(f, "      \"stats\": ");
+	write_normalized(f, t, doc);
+	fprintf(f, ",\n");
+	fprintf(f, "      \"result\": %s", buf ? buf : "null");
+
+	json_free(doc);
+	free(buf);
+}
+
+/* Write @str as a JSON member, the command lines may contain quotes */
+static void write_string(FILE *f, const char *key, const char *str)
+{
+	fprintf(f, "\"%s\": ", key);
+	rt_write_json_string(f, str);
+	fprintf(f, ",\n");
+}
+
+static void write_stats(FILE *f, void *data)
+{
+	int i;
+
+	fprintf(f, "  ");
+	write_string(f, "scenario", scenario);
+	fprintf(f, "  \"warmup\": %d,\n", warmup);
+	fprintf(f, "  \"duration\": %d,\n", duration);
+	fprintf(f, "  \"tests\": [\n");
+	for (i = 0; i < nr_tests; i++) {
+		struct test *t = &tests[i];
+		enum stage st = t->role == ROLE_LOAD ? STAGE_LOAD : STAGE_TEST;
+
+		fprintf(f, "    {\n");
+		fprintf(f, "      ");
+		write_string(f, "name", t->name);
+		fprintf(f, "      \"role\": \"%s\",\n", role_names[t->role]);
+		fprintf(f, "      ");
+		write_string(f, "cpus", t->cpus ? t->cpus : "");
+		fprintf(f, "      ");
+		write_string(f, "cmdline", t->cmdline);
+		fprintf(f, "      \"started\": %d,\n", stamps[i].started);
+		if (stamps[i].started) {
+			fprintf(f, "      \"start_offset_us\": %ld,\n",
+				(long)calcdiff(stamps[i].ts, released[st]));
+			fprintf(f, "      \"runtime_ms\": %ld,\n",
+				(long)(calcdiff(t->end, stamps[i].ts) / 1000));
+		}
+		if (WIFEXITED(t->status))
+			fprintf(f, "      \"exit_code\": %d,\n",
+				WEXITSTATUS(t->status));
+		else
+			fprintf(f, "      \"signal\": %d,\n",
+				WTERMSIG(t->status));
+		fprintf(f, "      \"failed\": %d,\n", test_failed(t));
+		write_result(f, t);
+		fprintf(f, "\n    }%s\n", i == nr_tests - 1 ? "" : ",");
+	}
+	fprintf(f, "  ]\n");
+}
+
+static void print_summary(void)
+{
+	int i;
+
+	printf("%-16s %-8s %-10s %12s %10s  %s\n",
+	       "NAME", "ROLE", "CPUS", "START(us)", "TIME(ms)", "STATUS");
+	for (i = 0; i < nr_tests; i++) {
+		struct test *t = &tests[i];
+		enum stage st = t->role == ROLE_LOAD ? STAGE_LOAD : STAGE_TEST;
+		char status[32];
+
+		if (WIFEXITED(t->status))
+			snprintf(status, sizeof(status), "exit %d",
+				 WEXITSTATUS(t->status));
+		else
+			snprintf(status, sizeof(status), "signal %d",
+				 WTERMSIG(t->status));
+
+		if (stamps[i].started)
+			printf("%-16s %-8s %-10s %12ld %10ld  %s\n",
+			       t->name, role_names[t->role],
+			       t->cpus ? t->cpus : "-",
+			       (long)calcdiff(stamps[i].ts, released[st]),
+			       (long)(calcdiff(t->end, stamps[i].ts) / 1000),
+			       status);
+		else
+			printf("%-16s %-8s %-10s %12s %10s  %s\n",
+			       t->name, role_names[t->role],
+			       t->cpus ? t->cpus : "-", "-", "-", status);
+	}
+}
+
+static void cleanup(void)
+{
+	int i;
+
+	for (i = 0; i < nr_tests; i++) {
+		if (tests[i].tool)
+			unlink(tests[i].jsonfile);
+	}
+	rmdir(tmpdir);
+}
+
+int main(int argc, char *argv[])
+{
+	int gates[NR_STAGES][2];
+	int loads_stopped = 0;
+	int has_load = 0;
+	int has_test = 0;
+	int failed = 0;
+	int status, i;
+	struct sigaction sa;
+	sigset_t mask, orig;
+	pid_t pid;
+
+	rt_init(argc, argv);
+	process_options(argc, argv);
+	parse_scenario(scenario);
+	find_exedir();
+
+	strcpy(tmpdir, "/tmp/rt-suite.XXXXXX");
+	if (!mkdtemp(tmpdir))
+		fatal("could not create a temporary directory: %s\n",
+		      strerror(errno));
+
+	for (i = 0; i < nr_tests; i++) {
+		struct test *t = &tests[i];
+
+		if (t->role == ROLE_LOAD)
+			has_load = 1;
+		else
+			has_test = 1;
+		if (!t->tool)
+			continue;
+		snprintf(t->jsonfile, sizeof(t->jsonfile), "%s/%d.json",
+			 tmpdir, i);
+		t->argv[t->argc] = malloc(MAX_PATH + 8);
+		if (!t->argv[t->argc])
+			fatal("out of memory\n");
+		sprintf(t->argv[t->argc++], "--json=%s", t->jsonfile);
+	}
+
+	stamps = mmap(NULL, nr_tests * sizeof(*stamps), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stamps == MAP_FAILED)
+		fatal("mmap failed: %s\n", strerror(errno));
+
+	for (i = 0; i < NR_STAGES; i++) {
+		if (pipe2(gates[i], O_CLOEXEC))
+			fatal("pipe failed: %s\n", strerror(errno));
+	}
+
+	/* no SA_RESTART, a stop has to interrupt the warmup sleep */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sighand;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGALRM, &sa, NULL);
+	sigaction(SIGCHLD, &sa, NULL);
+
+	for (i = 0; i < nr_tests; i++)
+		start_test(i, gates);
+
+	clock_gettime(CLOCK_MONOTONIC, &released[STAGE_LOAD]);
+	close(gates[STAGE_LOAD][1]);
+
+	if (has_load && warmup)
+		wait_warmup(warmup);
+
+	clock_gettime(CLOCK_MONOTONIC, &released[STAGE_TEST]);
+	close(gates[STAGE_TEST][1]);
+	close(gates[STAGE_LOAD][0]);
+	close(gates[STAGE_TEST][0]);
+
+	/*
+	 * Keep the signals blocked except while waiting in sigsuspend(), so
+	 * a stop arriving between the checks below and the wait is not lost.
+	 */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGALRM);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &orig);
+
+	if (duration)
+		alarm(duration);
+
+	while (count_running(0) + count_running(1)) {
+		if (stop == 1) {
+			/* the tests write their results on SIGINT */
+			stop_tests(SIGINT, 0);
+			stop_tests(SIGTERM, 1);
+			stop = 2;
+		}
+
+		/* load tests only run as long as there is something to load */
+		if (has_test && !count_running(0) && !loads_stopped) {
+			stop_tests(SIGTERM, 1);
+			loads_stopped = 1;
+		}
+
+		pid = waitpid(-1, &status, WNOHANG);
+		if (pid < 0)
+			break;
+		if (pid == 0) {
+			sigsuspend(&orig);
+			continue;
+		}
+		reap(pid, status);
+	}
+
+	for (i = 0; i < nr_tests; i++)
+		failed |= test_failed(&tests[i]);
+
+	print_summary();
+	if (strlen(jsonfile) != 0)
+		rt_write_json(jsonfile, failed, write_stats, NULL);
+	cleanup();
+
+	exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -33,6 +33,8 @@
 #include "rt-utils.h"
 #include "rt-sched.h"
 #include "rt-error.h"
+#include "rt-cgroup.h"
+#include "rt-irq.h"
 #include "histogram.h"
 
 #define _STR(x) #x
@@ -90,6 +92,8 @@ static pthread_barrier_t barrier;
 
 static int cpu_count;
 static int all_cpus;
+static int isolate;
+static int steer_irqs;
 static int nr_threads;
 static int use_nsecs;
 static int mark_fd;
@@ -657,7 +661,8 @@ static void teardown(void)
 {
 	int fd;
 
-	if (all_cpus)
+	/* cgroup_isolate() cleans up after itself */
+	if (all_cpus || isolate)
 		return;
 
 	fd = open_cpuset(CPUSET_PATH, "cpuset.cpu_exclusive");
@@ -698,7 +703,10 @@ static void usage(int error)
 	       "	 --histfile=<path> dump the latency histogram to <path> instead of stdout\n"
 	       "-i INTV  --interval        The shortest deadline for the tasks in us\n"
 	       "                           (default 1000us).\n"
+	       "         --isolate         isolate the CPUs given with -a CPUSET in a cgroup v2\n"
+	       "                           partition instead of a cgroup v1 cpuset\n"
 	       "         --json=FILENAME   write final results into FILENAME, JSON formatted\n"
+	       "         --steer-irqs      move all IRQs off the CPUs given with -a CPUSET\n"
 	       "-s STEP  --step            The amount to increase the deadline for each task in us\n"
 	       "                           (default 500us).\n"
 	       "-t NUM   --threads         The number of threads to run as deadline (default 1).\n"
@@ -1128,6 +1136,8 @@ static void write_stats(FILE *f, void *data)
 			fprintf(f, "      \"histogram\": {");
 			hist_print_json(s->hist, f);
 			fprintf(f, "      },\n");
+			fprintf(f, "      \"overflows\": %lu,\n",
+				s->hist->oflow_count);
 		}
 		fprintf(f, "      \"cycles\": %ld,\n", s->cycles);
 		fprintf(f, "      \"min\": %ld,\n", s->min);
@@ -1142,7 +1152,7 @@ enum options_values {
 	OPT_AFFINITY=1, OPT_DURATION, OPT_HELP, OPT_INTERVAL,
 	OPT_JSON, OPT_STEP, OPT_THREADS, OPT_QUIET,
 	OPT_BREAKTRACE, OPT_TRACEMARK, OPT_INFO, OPT_DEBUG,
-	OPT_HISTOGRAM, OPT_HISTFILE
+	OPT_HISTOGRAM, OPT_HISTFILE, OPT_ISOLATE, OPT_STEER_IRQS
 };
 
 int main(int argc, char **argv)
@@ -1187,6 +1197,8 @@ int main(int argc, char **argv)
 			{ "debug",	no_argument, 	NULL, 	OPT_DEBUG},
 			{ "histogram",	required_argument, NULL, OPT_HISTOGRAM },
 			{ "histfile",	required_argument, NULL, OPT_HISTFILE },
+			{ "isolate",	no_argument,	NULL, OPT_ISOLATE },
+			{ "steer-irqs",	no_argument,	NULL, OPT_STEER_IRQS },
 			{ NULL,		0,			NULL,	0   },
 		};
 		c = getopt_long(argc, argv, "a::c:D:hi:s:t:b:q", options, NULL);
@@ -1256,6 +1268,12 @@ int main(int argc, char **argv)
 				fatal("Couldn\'t open histfile %s: %s\n",
 				      optarg, strerror(errno));
 			break;
+		case OPT_ISOLATE:
+			isolate = 1;
+			break;
+		case OPT_STEER_IRQS:
+			steer_irqs = 1;
+			break;
 		default:
 			usage(1);
 		}
@@ -1276,6 +1294,9 @@ int main(int argc, char **argv)
 		all_cpus = 1;
 	}
 
+	if (all_cpus && (isolate || steer_irqs))
+		fatal("--isolate and --steer-irqs require -a CPUSET\n");
+
 	/* Default cpu to use is the last one */
 	if (!all_cpus && !setcpu) {
 		setcpu_buf = malloc(12);
@@ -1366,7 +1387,16 @@ int main(int argc, char **argv)
 	if (shutdown)
 		fatal("failed to setup child threads at step 1\n");
 
-	if (!all_cpus) {
+	if (isolate) {
+		/* global EDF needs a load balanced root domain */
+		if (cgroup_isolate(setcpu, CGROUP_ROOT))
+			fatal("Could not isolate CPUs %s\n", setcpu);
+
+		for (i = 0; i < nr_threads; i++)
+			if (cgroup_isolate_thread(sched_data[i].stat.tid))
+				fatal("Could not move thread %d into the partition\n",
+				      sched_data[i].stat.tid);
+	} else if (!all_cpus) {
 		int *pids;
 
 		make_cpuset(CPUSET_ALL, allcpu_buf, "0",
@@ -1390,6 +1420,9 @@ int main(int argc, char **argv)
 		system("cat /sys/fs/cgroup/cpuset/my_cpuset/tasks");
 	}
 
+	if (steer_irqs && irq_steer_away(setcpu) < 0)
+		fatal("Could not steer IRQs away from CPUs %s\n", setcpu);
+
 	debug(debug_enable, "main thread %d\n", gettid());
 
 	if (shutdown)
@@ -43,6 +43,8 @@
 
 #include <rt-utils.h>
 #include <rt-sched.h>
+#include <rt-cgroup.h>
+#include <rt-irq.h>
 
 /**
  * usage - show the usage of the program and exit.
@@ -59,7 +61,10 @@ static void usage(int error)
 	       "-b                         Bind on the last cpu. (shortcut for -c <lastcpu>)\n"
 	       "-c CPUSET                  Comma/hyphen separated list of CPUs to run deadline\n"
 	       "                           tasks on\n"
+	       "-g                         Isolate the CPUs in a cgroup v2 partition instead\n"
+	       "                           of a cgroup v1 cpuset\n"
 	       "-h                         Show this help menu\n"
+	       "-I                         Move all IRQs off the CPUs given with -c or -b\n"
 	       "-i INTV                    The shortest deadline for the tasks\n"
 	       "-p PERCENT                 The percent of bandwidth to use (1-90%%)\n"
 	       "-P PERCENT                 The percent of runtime for execution completion\n"
@@ -1785,6 +1790,8 @@ int main(int argc, char **argv)
 	u64 end_period;
 	int nr_cpus;
 	int all_cpus = 1;
+	int isolate = 0;
+	int steer_irqs = 0;
 	int run_percent = 100;
 	int percent = 80;
 	int rt_task = 0;
@@ -1797,7 +1804,7 @@ int main(int argc, char **argv)
 		exit(-1);
 	}
 
-	while ((c = getopt(argc, argv, "+hbr:c:i:p:P:t:s:")) >= 0) {
+	while ((c = getopt(argc, argv, "+hbgr:c:i:Ip:P:t:s:")) >= 0) {
 		switch (c) {
 		case 'b':
 			all_cpus = 0;
@@ -1824,6 +1831,12 @@ int main(int argc, char **argv)
 		case 'r':
 			rt_task = atoi(optarg);
 			break;
+		case 'g':
+			isolate = 1;
+			break;
+		case 'I':
+			steer_irqs = 1;
+			break;
 		case 'h':
 			usage(0);
 			break;
@@ -1862,6 +1875,11 @@ int main(int argc, char **argv)
 	if (cpu_count == nr_cpus)
 		all_cpus = 1;
 
+	if (all_cpus && (isolate || steer_irqs)) {
+		fprintf(stderr, "-g and -I require -c CPUSET or -b\n");
+		exit(-1);
+	}
+
 	/* -b has us bind to the last CPU. */
 	if (!all_cpus && !setcpu) {
 		setcpu_buf = malloc(12);
@@ -2002,7 +2020,22 @@ int main(int argc, char **argv)
 	if (fail)
 		exit(-1);
 
-	if (!all_cpus) {
+	if (isolate) {
+		/* global EDF needs a load balanced root domain */
+		if (cgroup_isolate(setcpu, CGROUP_ROOT)) {
+			fprintf(stderr, "Could not isolate CPUs %s\n", setcpu);
+			exit(-1);
+		}
+
+		for (i = 0; i < nr_threads; i++)
+			if (cgroup_isolate_thread(sched_data[i].tid))
+				break;
+		if (i < nr_threads ||
+		    (rt_task && cgroup_isolate_thread(rt_sched_data.tid))) {
+			fprintf(stderr, "Could not move the threads into the partition\n");
+			exit(-1);
+		}
+	} else if (!all_cpus) {
 		int *pids;
 
 		atexit(teardown);
@@ -2044,6 +2077,12 @@ int main(int argc, char **argv)
 		system("cat /sys/fs/cgroup/cpuset/my_cpuset/tasks");
 	}
 
+	if (steer_irqs && irq_steer_away(setcpu) < 0) {
+		fprintf(stderr, "Could not steer IRQs away from CPUs %s\n",
+			setcpu);
+		exit(-1);
+	}
+
 	pthread_barrier_wait(&barrier);
 
 	if (fail)
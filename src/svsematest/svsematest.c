@@ -33,6 +33,8 @@
 #include "rt-utils.h"
 #include "rt-get_cpu.h"
 #include "rt-error.h"
+#include "rt-cgroup.h"
+#include "rt-irq.h"
 
 #define SEM_WAIT_FOR_RECEIVER 0
 #define SEM_WAIT_FOR_SENDER 1
@@ -74,6 +76,7 @@ static int wasforked;
 static int wasforked_sender = -1;
 static int wasforked_threadno = -1;
 static int tracelimit;
+static int isolate;
 
 void *semathread(void *param)
 {
@@ -92,6 +95,10 @@ void *semathread(void *param)
 	schedp.sched_priority = par->priority;
 	sched_setscheduler(0, policy, &schedp);
 
+	/* the main thread stays on the housekeeping CPUs */
+	if (isolate && cgroup_isolate_thread(0))
+		fatal("Could not move thread into the isolated partition\n");
+
 	if (par->cpu != -1) {
 		CPU_ZERO(&mask);
 		CPU_SET(par->cpu, &mask);
@@ -233,11 +240,14 @@ static void display_help(int error)
 	       "                           days.\n"
 	       "-f [OPT] --fork[=OPT]      fork new processes instead of creating threads\n"
 	       "-i INTV  --interval=INTV   base interval of thread in us default=1000\n"
+	       "         --isolate         run on a cgroup v2 isolated partition made of\n"
+	       "                           the CPU given with -a NUM\n"
 	       "         --json=FILENAME   write final results into FILENAME, JSON formatted\n"
 	       "-l LOOPS --loops=LOOPS     number of loops: default=0(endless)\n"
 	       "-p PRIO  --prio=PRIO       priority\n"
 	       "-S       --smp             SMP testing: options -a -t and same priority\n"
 	       "                           of all threads\n"
+	       "         --steer-irqs      move all IRQs off the CPU given with -a NUM\n"
 	       "-t       --threads         one thread per available processor\n"
 	       "-t [NUM] --threads[=NUM]   number of threads:\n"
 	       "                           without NUM, threads = max_cpus\n"
@@ -248,6 +258,7 @@ static void display_help(int error)
 
 static int setaffinity = AFFINITY_UNSPECIFIED;
 static int affinity;
+static int steer_irqs;
 static int priority;
 static int num_threads = 1;
 static int max_cycles;
@@ -261,8 +272,8 @@ static char jsonfile[MAX_PATH];
 
 enum option_value {
 	OPT_AFFINITY=1, OPT_BREAKTRACE, OPT_DISTANCE, OPT_DURATION,
-	OPT_FORK, OPT_HELP, OPT_INTERVAL, OPT_JSON, OPT_LOOPS,
-	OPT_PRIORITY, OPT_QUIET, OPT_SMP, OPT_THREADS
+	OPT_FORK, OPT_HELP, OPT_INTERVAL, OPT_ISOLATE, OPT_JSON, OPT_LOOPS,
+	OPT_PRIORITY, OPT_QUIET, OPT_SMP, OPT_STEER_IRQS, OPT_THREADS
 };
 
 static void process_options(int argc, char *argv[])
@@ -282,11 +293,13 @@ static void process_options(int argc, char *argv[])
 			{"fork",	optional_argument,	NULL, OPT_FORK},
 			{"help",	no_argument,		NULL, OPT_HELP},
 			{"interval",	required_argument,	NULL, OPT_INTERVAL},
+			{"isolate",	no_argument,		NULL, OPT_ISOLATE},
 			{"json",	required_argument,      NULL, OPT_JSON},
 			{"loops",	required_argument,	NULL, OPT_LOOPS},
 			{"priority",	required_argument,	NULL, OPT_PRIORITY},
 			{"quiet",	no_argument,		NULL, OPT_QUIET},
 			{"smp",		no_argument,		NULL, OPT_SMP},
+			{"steer-irqs",	no_argument,		NULL, OPT_STEER_IRQS},
 			{"threads",	optional_argument,	NULL, OPT_THREADS},
 			{NULL, 0, NULL, 0}
 		};
@@ -343,6 +356,12 @@ static void process_options(int argc, char *argv[])
 		case 'i':
 			interval = atoi(optarg);
 			break;
+		case OPT_ISOLATE:
+			isolate = 1;
+			break;
+		case OPT_STEER_IRQS:
+			steer_irqs = 1;
+			break;
 		case OPT_JSON:
 			strncpy(jsonfile, optarg, strnlen(optarg, MAX_PATH-1));
 			break;
@@ -409,6 +428,16 @@ static void process_options(int argc, char *argv[])
 
 		tracelimit = thistracelimit;
 	}
+	if (isolate && setaffinity != AFFINITY_SPECIFIED) {
+		fprintf(stderr, "ERROR: --isolate requires -a NUM\n");
+		error = 1;
+	}
+
+	if (steer_irqs && setaffinity != AFFINITY_SPECIFIED) {
+		fprintf(stderr, "ERROR: --steer-irqs requires -a NUM\n");
+		error = 1;
+	}
+
 	if (error)
 		display_help(error);
 }
@@ -520,6 +549,17 @@ int main(int argc, char *argv[])
 	if (check_privs())
 		return 1;
 
+	if (isolate || steer_irqs) {
+		char cpu[16];
+
+		snprintf(cpu, sizeof(cpu), "%d", affinity);
+		if (isolate && cgroup_isolate(cpu, CGROUP_ISOLATED))
+			fatal("Could not isolate CPU %d\n", affinity);
+		if (steer_irqs && irq_steer_away(cpu) < 0)
+			fatal("Could not steer IRQs away from CPU %d\n",
+			      affinity);
+	}
+
 	if (mlockall(MCL_CURRENT|MCL_FUTURE) == -1) {
 		perror("mlockall");
 		return 1;
@@ -680,6 +720,10 @@ int main(int argc, char *argv[])
 			} else if (pid == 0) {
 				char *args[3];
 
+				/* the exec'ed child does not know about it */
+				if (isolate && cgroup_isolate_thread(0))
+					fatal("Could not move child into the isolated partition\n");
+
 				receiver[i].num_threads = num_threads;
 				receiver[i].pid = getpid();
 				sprintf(f_opt, "-fr%d", i);
@@ -708,6 +752,10 @@ int main(int argc, char *argv[])
 			} else if (pid == 0) {
 				char *args[3];
 
+				/* the exec'ed child does not know about it */
+				if (isolate && cgroup_isolate_thread(0))
+					fatal("Could not move child into the isolated partition\n");
+
 				sender[i].num_threads = num_threads;
 				sender[i].pid = getpid();
 				sprintf(f_opt, "-fs%d", i);